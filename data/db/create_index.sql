@@ -30,39 +30,88 @@ DROP INDEX IF EXISTS index_14_0;
 DROP INDEX IF EXISTS index_14_1;
 DROP INDEX IF EXISTS index_15_0;
 DROP INDEX IF EXISTS index_15_1;
+DROP INDEX IF EXISTS index_1_i;
+DROP INDEX IF EXISTS index_1_s;
+DROP INDEX IF EXISTS index_2_i;
+DROP INDEX IF EXISTS index_2_s;
+DROP INDEX IF EXISTS index_3_i;
+DROP INDEX IF EXISTS index_3_s;
+DROP INDEX IF EXISTS index_4_i;
+DROP INDEX IF EXISTS index_4_s;
+DROP INDEX IF EXISTS index_5_i;
+DROP INDEX IF EXISTS index_5_s;
+DROP INDEX IF EXISTS index_6_i;
+DROP INDEX IF EXISTS index_6_s;
+DROP INDEX IF EXISTS index_7_i;
+DROP INDEX IF EXISTS index_7_s;
+DROP INDEX IF EXISTS index_8_i;
+DROP INDEX IF EXISTS index_8_s;
+DROP INDEX IF EXISTS index_9_i;
+DROP INDEX IF EXISTS index_9_s;
+DROP INDEX IF EXISTS index_10_i;
+DROP INDEX IF EXISTS index_10_s;
+DROP INDEX IF EXISTS index_11_i;
+DROP INDEX IF EXISTS index_11_s;
+DROP INDEX IF EXISTS index_12_i;
+DROP INDEX IF EXISTS index_12_s;
+DROP INDEX IF EXISTS index_13_i;
+DROP INDEX IF EXISTS index_13_s;
+DROP INDEX IF EXISTS index_14_i;
+DROP INDEX IF EXISTS index_14_s;
+DROP INDEX IF EXISTS index_15_i;
+DROP INDEX IF EXISTS index_15_s;
 
-/* create indexes */
-CREATE INDEX index_0_0 ON py_phrase_0(s0, y0);
-CREATE INDEX index_1_0 ON py_phrase_1(s0, y0, s1, y1);
+/* create indexes: the first index of a table has every syllable, then
+ * the freq and the phrase, so a lookup of exact syllables reads the rows
+ * in the order of the candidates from it, without a sort */
+CREATE INDEX index_0_0 ON py_phrase_0(s0, y0, freq DESC, phrase);
+CREATE INDEX index_1_0 ON py_phrase_1(s0, y0, s1, y1, freq DESC, phrase);
 CREATE INDEX index_1_1 ON py_phrase_1(s0, s1, y1);
-CREATE INDEX index_2_0 ON py_phrase_2(s0, y0, s1, y1, s2, y2);
+CREATE INDEX index_2_0 ON py_phrase_2(s0, y0, s1, y1, s2, y2, freq DESC, phrase);
 CREATE INDEX index_2_1 ON py_phrase_2(s0, s1, s2, y2);
-CREATE INDEX index_3_0 ON py_phrase_3(s0, y0, s1, y1, s2, y2);
+CREATE INDEX index_3_0 ON py_phrase_3(s0, y0, s1, y1, s2, y2, s3, y3, freq DESC, phrase);
 CREATE INDEX index_3_1 ON py_phrase_3(s0, s1, s2, y2);
-CREATE INDEX index_4_0 ON py_phrase_4(s0, y0, s1, y1, s2, y2);
+CREATE INDEX index_4_0 ON py_phrase_4(s0, y0, s1, y1, s2, y2, s3, y3, s4, y4, freq DESC, phrase);
 CREATE INDEX index_4_1 ON py_phrase_4(s0, s1, s2, y2);
-CREATE INDEX index_5_0 ON py_phrase_5(s0, y0, s1, y1, s2, y2);
+CREATE INDEX index_5_0 ON py_phrase_5(s0, y0, s1, y1, s2, y2, s3, y3, s4, y4, s5, y5, freq DESC, phrase);
 CREATE INDEX index_5_1 ON py_phrase_5(s0, s1, s2, y2);
-CREATE INDEX index_6_0 ON py_phrase_6(s0, y0, s1, y1, s2, y2);
+CREATE INDEX index_6_0 ON py_phrase_6(s0, y0, s1, y1, s2, y2, s3, y3, s4, y4, s5, y5, s6, y6, freq DESC, phrase);
 CREATE INDEX index_6_1 ON py_phrase_6(s0, s1, s2, y2);
-CREATE INDEX index_7_0 ON py_phrase_7(s0, y0, s1, y1, s2, y2);
+CREATE INDEX index_7_0 ON py_phrase_7(s0, y0, s1, y1, s2, y2, s3, y3, s4, y4, s5, y5, s6, y6, s7, y7, freq DESC, phrase);
 CREATE INDEX index_7_1 ON py_phrase_7(s0, s1, s2, y2);
-CREATE INDEX index_8_0 ON py_phrase_8(s0, y0, s1, y1, s2, y2);
+CREATE INDEX index_8_0 ON py_phrase_8(s0, y0, s1, y1, s2, y2, s3, y3, s4, y4, s5, y5, s6, y6, s7, y7, s8, y8, freq DESC, phrase);
 CREATE INDEX index_8_1 ON py_phrase_8(s0, s1, s2, y2);
-CREATE INDEX index_9_0 ON py_phrase_9(s0, y0, s1, y1, s2, y2);
+CREATE INDEX index_9_0 ON py_phrase_9(s0, y0, s1, y1, s2, y2, s3, y3, s4, y4, s5, y5, s6, y6, s7, y7, s8, y8, s9, y9, freq DESC, phrase);
 CREATE INDEX index_9_1 ON py_phrase_9(s0, s1, s2, y2);
-CREATE INDEX index_10_0 ON py_phrase_10(s0, y0, s1, y1, s2, y2);
+CREATE INDEX index_10_0 ON py_phrase_10(s0, y0, s1, y1, s2, y2, s3, y3, s4, y4, s5, y5, s6, y6, s7, y7, s8, y8, s9, y9, s10, y10, freq DESC, phrase);
 CREATE INDEX index_10_1 ON py_phrase_10(s0, s1, s2, y2);
-CREATE INDEX index_11_0 ON py_phrase_11(s0, y0, s1, y1, s2, y2);
+CREATE INDEX index_11_0 ON py_phrase_11(s0, y0, s1, y1, s2, y2, s3, y3, s4, y4, s5, y5, s6, y6, s7, y7, s8, y8, s9, y9, s10, y10, s11, y11, freq DESC, phrase);
 CREATE INDEX index_11_1 ON py_phrase_11(s0, s1, s2, y2);
-CREATE INDEX index_12_0 ON py_phrase_12(s0, y0, s1, y1, s2, y2);
+CREATE INDEX index_12_0 ON py_phrase_12(s0, y0, s1, y1, s2, y2, s3, y3, s4, y4, s5, y5, s6, y6, s7, y7, s8, y8, s9, y9, s10, y10, s11, y11, s12, y12, freq DESC, phrase);
 CREATE INDEX index_12_1 ON py_phrase_12(s0, s1, s2, y2);
-CREATE INDEX index_13_0 ON py_phrase_13(s0, y0, s1, y1, s2, y2);
+CREATE INDEX index_13_0 ON py_phrase_13(s0, y0, s1, y1, s2, y2, s3, y3, s4, y4, s5, y5, s6, y6, s7, y7, s8, y8, s9, y9, s10, y10, s11, y11, s12, y12, s13, y13, freq DESC, phrase);
 CREATE INDEX index_13_1 ON py_phrase_13(s0, s1, s2, y2);
-CREATE INDEX index_14_0 ON py_phrase_14(s0, y0, s1, y1, s2, y2);
+CREATE INDEX index_14_0 ON py_phrase_14(s0, y0, s1, y1, s2, y2, s3, y3, s4, y4, s5, y5, s6, y6, s7, y7, s8, y8, s9, y9, s10, y10, s11, y11, s12, y12, s13, y13, s14, y14, freq DESC, phrase);
 CREATE INDEX index_14_1 ON py_phrase_14(s0, s1, s2, y2);
-CREATE INDEX index_15_0 ON py_phrase_15(s0, y0, s1, y1, s2, y2);
+CREATE INDEX index_15_0 ON py_phrase_15(s0, y0, s1, y1, s2, y2, s3, y3, s4, y4, s5, y5, s6, y6, s7, y7, s8, y8, s9, y9, s10, y10, s11, y11, s12, y12, s13, y13, s14, y14, s15, y15, freq DESC, phrase);
 CREATE INDEX index_15_1 ON py_phrase_15(s0, s1, s2, y2);
 
+/* create initials indexes, on the sheng columns */
+CREATE INDEX index_1_s ON py_phrase_1(s0, s1);
+CREATE INDEX index_2_s ON py_phrase_2(s0, s1, s2);
+CREATE INDEX index_3_s ON py_phrase_3(s0, s1, s2, s3);
+CREATE INDEX index_4_s ON py_phrase_4(s0, s1, s2, s3, s4);
+CREATE INDEX index_5_s ON py_phrase_5(s0, s1, s2, s3, s4, s5);
+CREATE INDEX index_6_s ON py_phrase_6(s0, s1, s2, s3, s4, s5, s6);
+CREATE INDEX index_7_s ON py_phrase_7(s0, s1, s2, s3, s4, s5, s6, s7);
+CREATE INDEX index_8_s ON py_phrase_8(s0, s1, s2, s3, s4, s5, s6, s7, s8);
+CREATE INDEX index_9_s ON py_phrase_9(s0, s1, s2, s3, s4, s5, s6, s7, s8, s9);
+CREATE INDEX index_10_s ON py_phrase_10(s0, s1, s2, s3, s4, s5, s6, s7, s8, s9, s10);
+CREATE INDEX index_11_s ON py_phrase_11(s0, s1, s2, s3, s4, s5, s6, s7, s8, s9, s10, s11);
+CREATE INDEX index_12_s ON py_phrase_12(s0, s1, s2, s3, s4, s5, s6, s7, s8, s9, s10, s11, s12);
+CREATE INDEX index_13_s ON py_phrase_13(s0, s1, s2, s3, s4, s5, s6, s7, s8, s9, s10, s11, s12, s13);
+CREATE INDEX index_14_s ON py_phrase_14(s0, s1, s2, s3, s4, s5, s6, s7, s8, s9, s10, s11, s12, s13, s14);
+CREATE INDEX index_15_s ON py_phrase_15(s0, s1, s2, s3, s4, s5, s6, s7, s8, s9, s10, s11, s12, s13, s14, s15);
+
 /* optimize database */
 VACUUM;
@@ -0,0 +1,78 @@
+/* Converts a phrase database to the keyed format: every table gets a
+ * column k which packs the first 5 syllables of a phrase, 6 bits sheng
+ * and 6 bits yun each, the first syllable in the highest bits. The
+ * covering index on k holds every column a query reads, so lookups are
+ * answered from the index alone. Run create_index.sql first. */
+
+/* drop key indexes */
+DROP INDEX IF EXISTS index_0_k;
+DROP INDEX IF EXISTS index_1_k;
+DROP INDEX IF EXISTS index_2_k;
+DROP INDEX IF EXISTS index_3_k;
+DROP INDEX IF EXISTS index_4_k;
+DROP INDEX IF EXISTS index_5_k;
+DROP INDEX IF EXISTS index_6_k;
+DROP INDEX IF EXISTS index_7_k;
+DROP INDEX IF EXISTS index_8_k;
+DROP INDEX IF EXISTS index_9_k;
+DROP INDEX IF EXISTS index_10_k;
+DROP INDEX IF EXISTS index_11_k;
+DROP INDEX IF EXISTS index_12_k;
+DROP INDEX IF EXISTS index_13_k;
+DROP INDEX IF EXISTS index_14_k;
+DROP INDEX IF EXISTS index_15_k;
+
+/* add and fill the key column */
+ALTER TABLE py_phrase_0 ADD COLUMN k INTEGER;
+ALTER TABLE py_phrase_1 ADD COLUMN k INTEGER;
+ALTER TABLE py_phrase_2 ADD COLUMN k INTEGER;
+ALTER TABLE py_phrase_3 ADD COLUMN k INTEGER;
+ALTER TABLE py_phrase_4 ADD COLUMN k INTEGER;
+ALTER TABLE py_phrase_5 ADD COLUMN k INTEGER;
+ALTER TABLE py_phrase_6 ADD COLUMN k INTEGER;
+ALTER TABLE py_phrase_7 ADD COLUMN k INTEGER;
+ALTER TABLE py_phrase_8 ADD COLUMN k INTEGER;
+ALTER TABLE py_phrase_9 ADD COLUMN k INTEGER;
+ALTER TABLE py_phrase_10 ADD COLUMN k INTEGER;
+ALTER TABLE py_phrase_11 ADD COLUMN k INTEGER;
+ALTER TABLE py_phrase_12 ADD COLUMN k INTEGER;
+ALTER TABLE py_phrase_13 ADD COLUMN k INTEGER;
+ALTER TABLE py_phrase_14 ADD COLUMN k INTEGER;
+ALTER TABLE py_phrase_15 ADD COLUMN k INTEGER;
+UPDATE py_phrase_0 SET k=(s0<<54)|(y0<<48);
+UPDATE py_phrase_1 SET k=(s0<<54)|(y0<<48)|(s1<<42)|(y1<<36);
+UPDATE py_phrase_2 SET k=(s0<<54)|(y0<<48)|(s1<<42)|(y1<<36)|(s2<<30)|(y2<<24);
+UPDATE py_phrase_3 SET k=(s0<<54)|(y0<<48)|(s1<<42)|(y1<<36)|(s2<<30)|(y2<<24)|(s3<<18)|(y3<<12);
+UPDATE py_phrase_4 SET k=(s0<<54)|(y0<<48)|(s1<<42)|(y1<<36)|(s2<<30)|(y2<<24)|(s3<<18)|(y3<<12)|(s4<<6)|(y4<<0);
+UPDATE py_phrase_5 SET k=(s0<<54)|(y0<<48)|(s1<<42)|(y1<<36)|(s2<<30)|(y2<<24)|(s3<<18)|(y3<<12)|(s4<<6)|(y4<<0);
+UPDATE py_phrase_6 SET k=(s0<<54)|(y0<<48)|(s1<<42)|(y1<<36)|(s2<<30)|(y2<<24)|(s3<<18)|(y3<<12)|(s4<<6)|(y4<<0);
+UPDATE py_phrase_7 SET k=(s0<<54)|(y0<<48)|(s1<<42)|(y1<<36)|(s2<<30)|(y2<<24)|(s3<<18)|(y3<<12)|(s4<<6)|(y4<<0);
+UPDATE py_phrase_8 SET k=(s0<<54)|(y0<<48)|(s1<<42)|(y1<<36)|(s2<<30)|(y2<<24)|(s3<<18)|(y3<<12)|(s4<<6)|(y4<<0);
+UPDATE py_phrase_9 SET k=(s0<<54)|(y0<<48)|(s1<<42)|(y1<<36)|(s2<<30)|(y2<<24)|(s3<<18)|(y3<<12)|(s4<<6)|(y4<<0);
+UPDATE py_phrase_10 SET k=(s0<<54)|(y0<<48)|(s1<<42)|(y1<<36)|(s2<<30)|(y2<<24)|(s3<<18)|(y3<<12)|(s4<<6)|(y4<<0);
+UPDATE py_phrase_11 SET k=(s0<<54)|(y0<<48)|(s1<<42)|(y1<<36)|(s2<<30)|(y2<<24)|(s3<<18)|(y3<<12)|(s4<<6)|(y4<<0);
+UPDATE py_phrase_12 SET k=(s0<<54)|(y0<<48)|(s1<<42)|(y1<<36)|(s2<<30)|(y2<<24)|(s3<<18)|(y3<<12)|(s4<<6)|(y4<<0);
+UPDATE py_phrase_13 SET k=(s0<<54)|(y0<<48)|(s1<<42)|(y1<<36)|(s2<<30)|(y2<<24)|(s3<<18)|(y3<<12)|(s4<<6)|(y4<<0);
+UPDATE py_phrase_14 SET k=(s0<<54)|(y0<<48)|(s1<<42)|(y1<<36)|(s2<<30)|(y2<<24)|(s3<<18)|(y3<<12)|(s4<<6)|(y4<<0);
+UPDATE py_phrase_15 SET k=(s0<<54)|(y0<<48)|(s1<<42)|(y1<<36)|(s2<<30)|(y2<<24)|(s3<<18)|(y3<<12)|(s4<<6)|(y4<<0);
+
+/* create covering key indexes */
+CREATE INDEX index_0_k ON py_phrase_0(k, freq, phrase);
+CREATE INDEX index_1_k ON py_phrase_1(k, freq, phrase);
+CREATE INDEX index_2_k ON py_phrase_2(k, freq, phrase);
+CREATE INDEX index_3_k ON py_phrase_3(k, freq, phrase);
+CREATE INDEX index_4_k ON py_phrase_4(k, freq, phrase);
+CREATE INDEX index_5_k ON py_phrase_5(k, s5, y5, freq, phrase);
+CREATE INDEX index_6_k ON py_phrase_6(k, s5, y5, s6, y6, freq, phrase);
+CREATE INDEX index_7_k ON py_phrase_7(k, s5, y5, s6, y6, s7, y7, freq, phrase);
+CREATE INDEX index_8_k ON py_phrase_8(k, s5, y5, s6, y6, s7, y7, s8, y8, freq, phrase);
+CREATE INDEX index_9_k ON py_phrase_9(k, s5, y5, s6, y6, s7, y7, s8, y8, s9, y9, freq, phrase);
+CREATE INDEX index_10_k ON py_phrase_10(k, s5, y5, s6, y6, s7, y7, s8, y8, s9, y9, s10, y10, freq, phrase);
+CREATE INDEX index_11_k ON py_phrase_11(k, s5, y5, s6, y6, s7, y7, s8, y8, s9, y9, s10, y10, s11, y11, freq, phrase);
+CREATE INDEX index_12_k ON py_phrase_12(k, s5, y5, s6, y6, s7, y7, s8, y8, s9, y9, s10, y10, s11, y11, s12, y12, freq, phrase);
+CREATE INDEX index_13_k ON py_phrase_13(k, s5, y5, s6, y6, s7, y7, s8, y8, s9, y9, s10, y10, s11, y11, s12, y12, s13, y13, freq, phrase);
+CREATE INDEX index_14_k ON py_phrase_14(k, s5, y5, s6, y6, s7, y7, s8, y8, s9, y9, s10, y10, s11, y11, s12, y12, s13, y13, s14, y14, freq, phrase);
+CREATE INDEX index_15_k ON py_phrase_15(k, s5, y5, s6, y6, s7, y7, s8, y8, s9, y9, s10, y10, s11, y11, s12, y12, s13, y13, s14, y14, s15, y15, freq, phrase);
+
+/* optimize database */
+VACUUM;
@@ -0,0 +1,122 @@
+/* vim:set et ts=4 sts=4:
+ *
+ * libpyzy - The Chinese PinYin and Bopomofo conversion library.
+ *
+ * Copyright (c) 2008-2010 Peng Huang <shawn.p.huang@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#ifndef __PYZY_BLOOM_FILTER_H_
+#define __PYZY_BLOOM_FILTER_H_
+
+#include <glib.h>
+#include <cmath>
+#include <vector>
+
+namespace PyZy {
+
+/* A bloom filter of 64 bits keys. An empty filter contains everything, so
+ * a filter which was never built does not hide anything. */
+class BloomFilter {
+public:
+    BloomFilter (void) : m_hashes (0), m_count (0) { }
+
+    void reset (size_t capacity, double fp_rate = 0.01)
+    {
+        /* m = -n * ln (p) / ln (2) ^ 2, k = m / n * ln (2) */
+        double bits = - (double) capacity * std::log (fp_rate) / (G_LN2 * G_LN2);
+        size_t words = (size_t) bits / 64 + 1;
+
+        m_bits.assign (words, 0);
+        m_hashes = (unsigned int) (bits / capacity * G_LN2 + 0.5);
+        m_hashes = CLAMP (m_hashes, 1, 16);
+        m_count = 0;
+    }
+
+    void clear (void)
+    {
+        m_bits.clear ();
+        m_hashes = 0;
+        m_count = 0;
+    }
+
+    void insert (guint64 key)
+    {
+        if (G_UNLIKELY (m_bits.empty ()))
+            return;
+
+        guint64 h1 = hash (key);
+        guint64 h2 = hash (h1) | 1;
+        guint64 size = m_bits.size () * 64;
+
+        for (unsigned int i = 0; i < m_hashes; i++) {
+            guint64 bit = (h1 + i * h2) % size;
+            m_bits[bit / 64] |= (guint64) 1 << (bit % 64);
+        }
+        m_count ++;
+    }
+
+    bool contains (guint64 key) const
+    {
+        if (G_UNLIKELY (m_bits.empty ()))
+            return true;
+
+        guint64 h1 = hash (key);
+        guint64 h2 = hash (h1) | 1;
+        guint64 size = m_bits.size () * 64;
+
+        for (unsigned int i = 0; i < m_hashes; i++) {
+            guint64 bit = (h1 + i * h2) % size;
+            if ((m_bits[bit / 64] & ((guint64) 1 << (bit % 64))) == 0)
+                return false;
+        }
+        return true;
+    }
+
+    bool empty (void) const     { return m_bits.empty (); }
+    size_t count (void) const   { return m_count; }
+    size_t bytes (void) const   { return m_bits.size () * sizeof (guint64); }
+
+    /* The expected false positive rate with the current number of keys. */
+    double falsePositiveRate (void) const
+    {
+        if (m_bits.empty ())
+            return 1.0;
+        double bits = m_bits.size () * 64;
+        return std::pow (1.0 - std::exp (- (double) m_hashes * m_count / bits), (double) m_hashes);
+    }
+
+private:
+    static guint64 hash (guint64 key)
+    {
+        /* splitmix64 finalizer */
+        key ^= key >> 30;
+        key *= G_GUINT64_CONSTANT (0xbf58476d1ce4e5b9);
+        key ^= key >> 27;
+        key *= G_GUINT64_CONSTANT (0x94d049bb133111eb);
+        key ^= key >> 31;
+        return key;
+    }
+
+private:
+    std::vector<guint64> m_bits;
+    unsigned int m_hashes;
+    size_t m_count;
+};
+
+};  // namespace PyZy
+
+#endif  // __PYZY_BLOOM_FILTER_H_
@@ -32,11 +32,13 @@ struct Config {
                   PINYIN_CORRECT_ALL |
                   PINYIN_FUZZY_ALL),
           specialPhrases (true),
-          modeSimp (true) { }
+          modeSimp (true),
+          beamWidth (4) { }
 
     unsigned int option;
     bool specialPhrases;
     bool modeSimp;
+    unsigned int beamWidth;
 };
 
 };  // namespace PyZy
@@ -93,4 +93,72 @@
 #define BOPOMOFO_KEYBOARD_IBM        (3)
 #define BOPOMOFO_KEYBOARD_LAST       (4)  /** Number of BopomofoSchema */
 
+/**
+ * INIT_USER_DB_ON_DISK
+ *
+ * Attaches the user dictionary on disk in WAL mode, instead of copying it
+ * into memory at start and back to disk a while after every change.
+ * Learned phrases are written in batches, after a few commits or a few
+ * seconds, so a process which is killed loses the phrases of its last
+ * seconds. The journal mode the file had is set back when it is closed.
+ */
+#define INIT_USER_DB_ON_DISK         (1U << 0)
+
+/**
+ * USER_DB_LOCK_FILE
+ *
+ * A process which copies the user dictionary into memory writes its copy
+ * over the file later, and so over the changes other processes made
+ * meanwhile. It holds a shared flock(2) on this file, in the directory of
+ * the user dictionary. A process changing the file on disk, like
+ * pyzy-train, takes the lock exclusively first and refuses to run if it
+ * can not.
+ */
+#define USER_DB_LOCK_FILE            "user-1.0.db.lock"
+
+/**
+ * INIT_MAIN_DB_SHARED
+ *
+ * Opens the system dictionary read-only and memory-mapped, instead of
+ * reading it into a private cache of every process. Processes using the
+ * same dictionary share its pages in the page cache of the system. The
+ * dictionary file must not be changed while it is open.
+ */
+#define INIT_MAIN_DB_SHARED          (1U << 1)
+
+/**
+ * INIT_BACKEND_AUTO
+ *
+ * Looks up the system phrases in the compiled dictionary of the system
+ * dictionary if there is one, see pyzy-compile-dict, and with SQL if not.
+ */
+#define INIT_BACKEND_AUTO            (0U << 2)
+
+/**
+ * INIT_BACKEND_SQLITE
+ *
+ * Looks up every phrase with SQL, even if there is a compiled dictionary.
+ */
+#define INIT_BACKEND_SQLITE          (1U << 2)
+
+/**
+ * INIT_BACKEND_MAPPED
+ *
+ * Looks up the system phrases in the memory-mapped compiled dictionary.
+ * If there is none, it is compiled into the user cache directory.
+ */
+#define INIT_BACKEND_MAPPED          (2U << 2)
+
+/**
+ * INIT_BACKEND_MEMORY
+ *
+ * Loads every phrase of both dictionaries into memory when they are first
+ * looked up, and looks them up there. It takes much more memory, and is
+ * meant for measurements and tests. Learned phrases are still written to
+ * the user dictionary.
+ */
+#define INIT_BACKEND_MEMORY          (3U << 2)
+
+#define INIT_BACKEND_MASK            (3U << 2)
+
 #endif  // __PYZY_CONST_H_
@@ -21,84 +21,158 @@
  */
 #include "Database.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <set>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <sqlite3.h>
 
 #include "Config.h"
+#include "HotPhrases.h"
+#include "MappedDictionary.h"
 #include "PinyinArray.h"
+#include "PinyinOption.h"
+#include "QueryStats.h"
 #include "Util.h"
 
 
 namespace PyZy {
 
 #define DB_CACHE_SIZE       "5000"
-#define DB_INDEX_SIZE       (3)
 /* define columns */
 #define DB_COLUMN_USER_FREQ (0)
 #define DB_COLUMN_PHRASE    (1)
 #define DB_COLUMN_FREQ      (2)
-#define DB_COLUMN_S0        (3)
+#define DB_COLUMN_LEN       (3)
+#define DB_COLUMN_S0        (4)
 
 #define DB_PREFETCH_LEN     (6)
 #define DB_BACKUP_TIMEOUT   (60)
+#define DB_MMAP_SIZE        "67108864"
+#define DB_MAIN_MMAP_SIZE   "268435456"
+#define DB_STMT_CACHE_SIZE  (256)
+#define DB_RESULT_CACHE_SIZE    (128)
+
+/* Committed phrases are kept in memory and written to the user database
+ * in one transaction when there are DB_PENDING_SIZE of them, or
+ * DB_FLUSH_TIMEOUT seconds after the first one. The timeout needs a main
+ * loop of glib, so they are also written after DB_PENDING_COMMITS
+ * commits. The same timeout resets the statements of the cached results
+ * after a lookup. */
+#define DB_PENDING_SIZE     (64)
+#define DB_PENDING_COMMITS  (16)
+#define DB_FLUSH_TIMEOUT    (5)
+
+/* The number of user phrases of the highest user_freq kept in memory. */
+#define DB_HOT_SIZE         (2048)
+
+/* phrases written by a transaction of training or importing */
+#define DB_BULK_BATCH       (65536)
+
+/* Parameters bound to a query statement. ?1 is the LIMIT, ?2 to ?5 are
+ * the last row of the previous page, and every pinyin takes
+ * DB_PARAMS_PER_PINYIN slots: three shengs followed by two yuns. */
+#define DB_PARAM_LIMIT          (1)
+#define DB_PARAM_AFTER_LEN      (2)
+#define DB_PARAM_AFTER_USER_FREQ    (3)
+#define DB_PARAM_AFTER_FREQ     (4)
+#define DB_PARAM_AFTER_PHRASE   (5)
+#define DB_PARAMS_PER_PINYIN    (5)
+#define DB_PARAM_SHENG(i, j)    (6 + (i) * DB_PARAMS_PER_PINYIN + (j))
+#define DB_PARAM_YUN(i, j)      (6 + (i) * DB_PARAMS_PER_PINYIN + 3 + (j))
+
+/* The first DB_PAGE_SIZE rows are fetched with a LIMIT, so sqlite only
+ * keeps the top rows while sorting. The rest, which are rarely wanted,
+ * are fetched by one more statement after the last row of the page. */
+#define DB_PAGE_SIZE            (16)
+
+/* A query shape has one char per pinyin: 'a' + fuzzy shengs * 3 + yun state,
+ * in upper case when no phrase of that length can exist. */
+#define SHAPE_CHAR(mode, len)   ((char) ((len) ? 'a' + (mode) : 'A' + (mode)))
+#define SHAPE_MODE(c)           ((c) >= 'a' ? (c) - 'a' : (c) - 'A')
+#define SHAPE_SHENG(c)          (SHAPE_MODE (c) / 3)
+#define SHAPE_YUN(c)            (SHAPE_MODE (c) % 3)
+#define SHAPE_HAS_LEN(c)        ((c) >= 'a')
+
+/* The keyed dictionary format packs the first DB_KEY_SYLLABLES syllables
+ * of a phrase into an integer column k, 6 bits sheng and 6 bits yun each,
+ * the first syllable in the highest bits. A query seeks the covering
+ * index on k with at most DB_KEY_RANGES ranges for the leading syllables,
+ * and filters the other syllables in the index. */
+#define DB_KEY_SYLLABLES        (5)
+#define DB_KEY_RANGES           (6)
+#define DB_KEY_SHIFT_SHENG(i)   (54 - 12 * (i))
+#define DB_KEY_SHIFT_YUN(i)     (48 - 12 * (i))
+
+/* The initials index of a phrase table is on the sheng columns s0,...,
+ * which every version of sqlite reads. A phrase of an abbreviated query,
+ * which has pinyins without yun, seeks it with at most DB_KEY_RANGES
+ * combinations of the leading shengs. */
+
+/* The bounds of the ranges of each phrase length on the key are bound
+ * after the pinyin ids. */
+#define DB_PARAM_RANGE(len, r, j)   \
+    (6 + MAX_PHRASE_LEN * DB_PARAMS_PER_PINYIN + \
+     ((len) - 1) * DB_KEY_RANGES * 2 + (r) * 2 + (j))
+
+/* The database a query statement reads, prefixed to the shape in the
+ * statement cache. */
+#define DB_QUERY_MAIN           'M'
+#define DB_QUERY_USER           'U'
+
+/* Parameters bound to the statements which write the user database. */
+#define DB_WRITE_PARAM_PHRASE   (1)
+#define DB_WRITE_PARAM_VALUE    (2)     /* freq of INSERT, increment of UPDATE */
+#define DB_WRITE_PARAM_TIME     (3)     /* atime of INSERT and UPDATE */
+#define DB_WRITE_PARAM_SHENG(i) (4 + (i) * 2)
+#define DB_WRITE_PARAM_YUN(i)   (5 + (i) * 2)
+
+/* When the user database has more phrases than its limit, the phrases of
+ * the lowest scores are deleted until DB_COMPACT_LOW percent of the limit
+ * are left. The idle steps first count the scores of DB_COMPACT_SCAN rows
+ * each, to find the score of the last phrase to delete, then delete
+ * DB_COMPACT_BATCH phrases each. Both read the tables in the order of
+ * rowid, so every table is read once by each pass. The score is the
+ * user_freq, halved every DB_DECAY_HALF_LIFE seconds since the phrase was
+ * committed last time; a phrase without atime is taken as the oldest. */
+#define DB_COMPACT_LOW      (90)
+#define DB_COMPACT_SCAN     (4096)
+#define DB_COMPACT_BATCH    (256)
+#define DB_DECAY_HALF_LIFE  (30 * 24 * 60 * 60)
+#define DB_DECAY_SCORE(now) \
+    "(user_freq*1048576>>max(0,min(40,(" now "-coalesce(atime,0))/" \
+    G_STRINGIFY (DB_DECAY_HALF_LIFE) ")))"
+
+/* The phrase filter is keyed by the length and the first DB_FILTER_DEPTH
+ * syllables of a phrase, either with or without the yuns. */
+#define DB_FILTER_DEPTH     (3)
+#define DB_FILTER_FULL      (1)
+#define DB_FILTER_SHENG     (2)
+#define DB_FILTER_RESERVE   (4096)
 
 #define USER_DICTIONARY_FILE  "user-1.0.db"
 
 
 std::unique_ptr<Database> Database::m_instance;
 
-class Conditions : public std::vector<std::string> {
-public:
-    Conditions (void) : std::vector<std::string> (1) {}
-
-    void double_ (void) {
-        size_t i = size ();
-        // To avoid a invalid referece caused by a memory reallocation, which
-        // may occur on push_back, we call reserve here.
-        reserve (i * 2);
-        do {
-            push_back (at (--i));
-        } while (i > 0);
-    }
-
-    void triple (void) {
-        size_t i = size ();
-        // To avoid a invalid referece caused by a memory reallocation, which
-        // may occur on push_back, we call reserve here.
-        reserve (i * 3);
-        do {
-            const std::string & value = at (--i);
-            push_back (value);
-            push_back (value);
-        } while (i > 0);
-    }
-
-    void appendVPrintf (size_t begin, size_t end, const char *fmt, va_list args) {
-        char str[64];
-        g_vsnprintf (str, sizeof(str), fmt, args);
-        for (size_t i = begin; i < end; i++) {
-            at (i) += str;
-        }
-    }
-
-    void appendPrintf (size_t begin, size_t end, const char *fmt, ...) {
-        va_list args;
-        va_start (args, fmt);
-        appendVPrintf (begin, end, fmt, args);
-        va_end (args);
-    }
-};
-
 class SQLStmt {
 public:
     SQLStmt (sqlite3 *db)
-        : m_db (db), m_stmt (NULL) {
+        : m_db (db), m_stmt (NULL), m_lengths (0), m_exec_steps (0), m_exec_ns (0) {
         g_assert (m_db != NULL);
     }
 
     ~SQLStmt () {
         if (m_stmt != NULL) {
+            finishExecution ();
             if (sqlite3_finalize (m_stmt) != SQLITE_OK) {
                 g_warning ("destroy sqlite stmt failed!");
             }
@@ -106,7 +180,7 @@ public:
     }
 
     bool prepare (const String &sql) {
-        if (sqlite3_prepare (m_db,
+        if (sqlite3_prepare_v2 (m_db,
                              sql.c_str (),
                              sql.size (),
                              &m_stmt,
@@ -118,8 +192,53 @@ public:
         return true;
     }
 
+    void reset (void) {
+        finishExecution ();
+        sqlite3_reset (m_stmt);
+    }
+
+    bool bindInt (int index, int value) {
+        if (sqlite3_bind_int (m_stmt, index, value) != SQLITE_OK) {
+            g_warning ("bind sql parameter %d failed!", index);
+            return false;
+        }
+        return true;
+    }
+
+    bool bindText (int index, const std::string & value) {
+        if (sqlite3_bind_text (m_stmt, index, value.c_str (), value.size (),
+                               SQLITE_TRANSIENT) != SQLITE_OK) {
+            g_warning ("bind sql parameter %d failed!", index);
+            return false;
+        }
+        return true;
+    }
+
+    /* The text is not copied, it must be kept until the statement is reset. */
+    bool bindStaticText (int index, const char *value) {
+        if (sqlite3_bind_text (m_stmt, index, value, -1, SQLITE_STATIC) != SQLITE_OK) {
+            g_warning ("bind sql parameter %d failed!", index);
+            return false;
+        }
+        return true;
+    }
+
+    bool bindInt64 (int index, gint64 value) {
+        if (sqlite3_bind_int64 (m_stmt, index, value) != SQLITE_OK) {
+            g_warning ("bind sql parameter %d failed!", index);
+            return false;
+        }
+        return true;
+    }
+
     bool step (void) {
-        switch (sqlite3_step (m_stmt)) {
+        int ret;
+        if (G_UNLIKELY (m_stats.get () != NULL))
+            ret = timedStep ();
+        else
+            ret = sqlite3_step (m_stmt);
+
+        switch (ret) {
         case SQLITE_ROW:
             return true;
         case SQLITE_DONE:
@@ -138,9 +257,507 @@ public:
         return sqlite3_column_int (m_stmt, col);
     }
 
+    gint64 columnInt64 (int col) {
+        return sqlite3_column_int64 (m_stmt, col);
+    }
+
+    /* bit n - 1 is set if the statement returns phrases of length n */
+    unsigned int lengths (void) const       { return m_lengths; }
+    void setLengths (unsigned int lengths)  { m_lengths = lengths; }
+
+    /* The executions are recorded in stats, if it is not NULL. The
+     * counters of sqlite start again, so the steps which were not
+     * recorded are not added to stats. */
+    void setStats (const QueryStatsPtr & stats) {
+        finishExecution ();
+        m_stats = stats;
+        if (m_stats.get () != NULL) {
+            sqlite3_stmt_status (m_stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+            sqlite3_stmt_status (m_stmt, SQLITE_STMTSTATUS_SORT, 1);
+            sqlite3_stmt_status (m_stmt, SQLITE_STMTSTATUS_AUTOINDEX, 1);
+        }
+    }
+
+private:
+    int timedStep (void) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+        int ret = sqlite3_step (m_stmt);
+        m_exec_ns += std::chrono::duration_cast<std::chrono::nanoseconds> (
+                         std::chrono::steady_clock::now () - start).count ();
+        m_exec_steps ++;
+        m_stats->steps ++;
+        if (ret == SQLITE_ROW)
+            m_stats->rows ++;
+        return ret;
+    }
+
+    void finishExecution (void) {
+        if (m_exec_steps == 0)
+            return;
+        m_stats->addExecution (m_exec_ns);
+        m_stats->fullscan_steps += sqlite3_stmt_status (m_stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+        m_stats->sorts += sqlite3_stmt_status (m_stmt, SQLITE_STMTSTATUS_SORT, 1);
+        m_stats->autoindexes += sqlite3_stmt_status (m_stmt, SQLITE_STMTSTATUS_AUTOINDEX, 1);
+        m_exec_steps = 0;
+        m_exec_ns = 0;
+    }
+
 private:
     sqlite3 *m_db;
     sqlite3_stmt *m_stmt;
+    unsigned int m_lengths;
+    QueryStatsPtr m_stats;
+    unsigned long m_exec_steps;     /* of the current execution */
+    guint64 m_exec_ns;
+};
+
+inline static guint64
+filter_key (int kind, size_t len, const int *sheng, const int *yun)
+{
+    guint64 key = (len << 4) | kind;
+    for (size_t i = 0; i < MIN (len, DB_FILTER_DEPTH); i++) {
+        key = (key << 12) | (sheng[i] << 6);
+        if (kind == DB_FILTER_FULL)
+            key |= yun[i];
+    }
+    return key;
+}
+
+/* Appends the conditions of the i-th pinyin of a query shape, on the given
+ * sheng and yun column expressions. */
+static void
+append_condition (String &sql, const char *s, const char *y, size_t i, char shape)
+{
+    int sheng = SHAPE_SHENG (shape);
+    int yun = SHAPE_YUN (shape);
+
+    switch (sheng) {
+    case 0:
+        sql.appendPrintf ("%s=?%d", s, (int) DB_PARAM_SHENG (i, 0));
+        break;
+    case 1:
+    case 2:
+        sql.appendPrintf ("%s IN (?%d,?%d)", s,
+                          (int) DB_PARAM_SHENG (i, 0), (int) DB_PARAM_SHENG (i, sheng));
+        break;
+    default:
+        sql.appendPrintf ("%s IN (?%d,?%d,?%d)", s,
+                          (int) DB_PARAM_SHENG (i, 0), (int) DB_PARAM_SHENG (i, 1),
+                          (int) DB_PARAM_SHENG (i, 2));
+        break;
+    }
+
+    if (yun == 1) {
+        sql.appendPrintf (" AND %s=?%d", y, (int) DB_PARAM_YUN (i, 0));
+    }
+    else if (yun == 2) {
+        sql.appendPrintf (" AND %s IN (?%d,?%d)", y,
+                          (int) DB_PARAM_YUN (i, 0), (int) DB_PARAM_YUN (i, 1));
+    }
+}
+
+/* Returns how many leading pinyins of a phrase of length len are matched
+ * by ranges of the packed key, and the number of ranges in *ranges. A
+ * pinyin without yun matches every yun, so it ends the ranges. */
+static size_t
+key_prefix (const std::string & shape, size_t len, size_t *ranges)
+{
+    size_t n = 0;
+
+    *ranges = 1;
+    while (n < MIN (len, DB_KEY_SYLLABLES)) {
+        int sheng = SHAPE_SHENG (shape[n]);
+        int yun = SHAPE_YUN (shape[n]);
+        size_t alternatives = (sheng == 0 ? 1 : sheng == 3 ? 3 : 2) * (yun == 2 ? 2 : 1);
+
+        if (*ranges * alternatives > DB_KEY_RANGES)
+            break;
+        *ranges *= alternatives;
+        n++;
+        if (yun == 0)
+            break;
+    }
+    return n;
+}
+
+/* Checks whether a phrase of length len has a pinyin without yun before
+ * its last one, which the (s0,y0,...) indexes can not narrow on. */
+static bool
+is_abbreviated (const std::string & shape, size_t len)
+{
+    for (size_t i = 0; i + 1 < len; i++) {
+        if (SHAPE_YUN (shape[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+/* Returns how many leading shengs of a phrase of length len are sought
+ * in the initials index, and the number of combinations in *ranges. */
+static size_t
+initials_prefix (const std::string & shape, size_t len, size_t *ranges)
+{
+    size_t n = 0;
+
+    *ranges = 1;
+    while (n < len) {
+        int sheng = SHAPE_SHENG (shape[n]);
+        size_t alternatives = sheng == 0 ? 1 : sheng == 3 ? 3 : 2;
+
+        if (*ranges * alternatives > DB_KEY_RANGES)
+            break;
+        *ranges *= alternatives;
+        n++;
+    }
+    return n;
+}
+
+/* Reads the rows of a query statement one by one. */
+class QueryCursor {
+public:
+    QueryCursor (void)
+        : m_started (false), m_valid (false), m_suspended (false), m_limit (0), m_rows (0),
+          m_phrases_pos (0) { }
+
+    ~QueryCursor (void) {
+        if (m_stmt.get () != NULL)
+            m_stmt->reset ();
+    }
+
+    void setStmt (SQLStmtPtr stmt) {
+        m_stmt = stmt;
+        m_started = false;
+        m_valid = false;
+        m_suspended = false;
+    }
+
+    /* Reads the rows from phrases instead of a statement. */
+    void setPhrases (PhraseArray & phrases) {
+        m_phrases.swap (phrases);
+        m_phrases_pos = 0;
+        m_started = false;
+        m_valid = false;
+    }
+
+    /* Steps to the first row, when it is needed. */
+    void start (void) {
+        if (m_started)
+            return;
+        m_started = true;
+        m_limit = DB_PAGE_SIZE;
+        m_rows = 0;
+        if (m_stmt.get () != NULL)
+            bindPage (false);
+        next ();
+    }
+
+    /* Steps to the next row, and returns false at the end. */
+    bool next (void) {
+        if (m_stmt.get () == NULL && !m_phrases.empty ()) {
+            m_valid = m_phrases_pos < m_phrases.size ();
+            if (m_valid)
+                m_row = m_phrases[m_phrases_pos++];
+            return m_valid;
+        }
+
+        /* a suspended statement continues after the current row */
+        if (G_UNLIKELY (m_suspended)) {
+            m_suspended = false;
+            m_limit = DB_PAGE_SIZE;
+            m_rows = 0;
+            bindPage (true);
+        }
+
+        m_valid = m_stmt.get () != NULL && m_stmt->step ();
+
+        /* a full page may be followed by more rows, continue after the
+         * last row instead of sorting the first pages again */
+        if (!m_valid && m_stmt.get () != NULL && m_rows == m_limit) {
+            m_limit = -1;
+            m_rows = 0;
+            bindPage (true);
+            m_valid = m_stmt->step ();
+        }
+
+        if (!m_valid) {
+            if (m_stmt.get () != NULL)
+                m_stmt->reset ();
+            m_stmt.reset ();
+            return false;
+        }
+
+        m_rows ++;
+        m_last_phrase = m_stmt->columnText (DB_COLUMN_PHRASE);
+        g_strlcpy (m_row.phrase,
+                   m_last_phrase.c_str (),
+                   sizeof (m_row.phrase));
+        m_row.freq = m_stmt->columnInt (DB_COLUMN_FREQ);
+        m_row.user_freq = m_stmt->columnInt (DB_COLUMN_USER_FREQ);
+        m_row.len = m_stmt->columnInt (DB_COLUMN_LEN);
+
+        for (size_t i = 0, column = DB_COLUMN_S0; i < m_row.len; i++) {
+            m_row.pinyin_id[i].sheng = m_stmt->columnInt (column++);
+            m_row.pinyin_id[i].yun = m_stmt->columnInt (column++);
+        }
+        return true;
+    }
+
+    bool started (void) const           { return m_started; }
+    bool valid (void) const             { return m_valid; }
+
+    /* Resets a statement which is stepped, so it does not keep a read
+     * transaction open. The next step continues after the current row. */
+    void suspend (void) {
+        if (m_valid && m_stmt.get () != NULL && !m_suspended) {
+            m_stmt->reset ();
+            m_suspended = true;
+        }
+    }
+
+private:
+    void bindPage (bool after) {
+        m_stmt->reset ();
+        m_stmt->bindInt (DB_PARAM_LIMIT, m_limit);
+        if (after) {
+            m_stmt->bindInt (DB_PARAM_AFTER_LEN, m_row.len);
+            m_stmt->bindInt (DB_PARAM_AFTER_USER_FREQ, m_row.user_freq);
+            m_stmt->bindInt (DB_PARAM_AFTER_FREQ, m_row.freq);
+            m_stmt->bindText (DB_PARAM_AFTER_PHRASE, m_last_phrase);
+        }
+    }
+
+public:
+    const Phrase & row (void) const     { return m_row; }
+
+private:
+    SQLStmtPtr m_stmt;
+    Phrase m_row;
+    std::string m_last_phrase;  /* untruncated text of m_row */
+    bool m_started;
+    bool m_valid;
+    bool m_suspended;           /* the statement is reset after m_row */
+    int m_limit;                /* rows of the current page, -1 for all */
+    int m_rows;                 /* rows stepped in the current page */
+    PhraseArray m_phrases;      /* rows which are not read from a statement */
+    size_t m_phrases_pos;
+};
+
+/* Inserts a phrase into phrases sorted in the order of the queries. */
+static void
+insert_sorted (PhraseArray & phrases, const Phrase & phrase)
+{
+    PhraseArray::iterator it = phrases.begin ();
+    while (it != phrases.end () && phrase_before (*it, phrase))
+        ++it;
+    phrases.insert (it, phrase);
+}
+
+/* The candidates of a pinyin span. A result is shared by all queries of
+ * the same syllables and option. The rows of the main and the user
+ * database come from two statements which are sorted in the same order,
+ * and are merged and deduplicated on demand. The statements are not
+ * stepped while the hot user phrases are known to go first. */
+class QueryResult : public PhraseResult {
+public:
+    QueryResult (const PinyinArray    & pinyin,
+                 size_t                 pinyin_begin,
+                 size_t                 pinyin_len,
+                 unsigned int           option)
+        : m_pending_pos (0),
+          m_hot_pos (0),
+          m_hot_threshold (0),
+          m_hot_complete (false),
+          m_seen_len (0),
+          m_lengths (0),
+          m_expected (0) {
+        const PinyinOptionTable & table = PinyinOptionTable::get (option);
+        for (size_t i = 0; i < pinyin_len; i++)
+            m_masks.push_back (table.mask (pinyin[i + pinyin_begin]));
+    }
+
+    /* lengths has bit n - 1 set if phrases of length n may match. */
+    void setStmts (SQLStmtPtr main_stmt, SQLStmtPtr user_stmt, unsigned int lengths) {
+        m_expected = lengths;
+        m_main.setStmt (main_stmt);
+        m_user.setStmt (user_stmt);
+    }
+
+    /* Takes the main phrases of the span from the compiled dictionary. */
+    void setMainPhrases (PhraseArray & phrases) {
+        m_main.setPhrases (phrases);
+    }
+
+    /* Adds a pending update of the user database, which goes before the
+     * stored row of the phrase as it has a larger user_freq. */
+    void addPending (const Phrase & phrase) {
+        insert_sorted (m_pending, phrase);
+    }
+
+    /* Takes the hot phrases of the span. If the set is complete, they are
+     * all the user phrases, and the user statement is not needed. */
+    void setHot (const HotPhrases & hot) {
+        for (guint64 shengs = m_masks[0].sheng; shengs != 0; shengs &= shengs - 1) {
+            for (guint64 yuns = m_masks[0].yun; yuns != 0; yuns &= yuns - 1) {
+                const PhraseArray *bucket = hot.bucket (__builtin_ctzll (shengs),
+                                                        __builtin_ctzll (yuns));
+                for (size_t j = 0; bucket != NULL && j < bucket->size (); j++) {
+                    if (matches ((*bucket)[j]))
+                        insert_sorted (m_hot, (*bucket)[j]);
+                }
+            }
+        }
+        m_hot_threshold = hot.threshold ();
+        m_hot_complete = hot.complete ();
+    }
+
+    /* Fetches rows until there are count phrases or no more rows. */
+    void fetch (size_t count) {
+        if (m_phrases.size () >= count)
+            return;
+
+        while (m_phrases.size () < count) {
+            int source = next ();
+            if (source == SOURCE_NONE) {
+                Database::instance ().filterMissed (
+                    __builtin_popcount (m_expected & ~m_lengths));
+                m_lengths = m_expected;
+                break;
+            }
+
+            const Phrase & phrase = row (source);
+
+            if (phrase.len != m_seen_len) {
+                m_seen.clear ();
+                m_seen_len = phrase.len;
+            }
+            if (!m_seen.insert (phrase.phrase).second) {
+                advance (source);
+                continue;
+            }
+
+            /* rows come longest first, so the longer lengths which passed
+             * the filter but had no rows are known to be empty now */
+            unsigned int missed = m_expected & ~m_lengths & ~((1U << phrase.len) - 1);
+            if (G_UNLIKELY (missed != 0))
+                Database::instance ().filterMissed (__builtin_popcount (missed));
+            m_lengths |= missed | (1U << (phrase.len - 1));
+
+            m_phrases.push_back (phrase);
+            advance (source);
+        }
+
+        Database::instance ().hotFetched (!m_main.started ());
+    }
+
+    /* Checks whether the phrase is one of the candidates of the span. */
+    bool matches (const Phrase & phrase) const {
+        if (phrase.len > m_masks.size ())
+            return false;
+        for (size_t i = 0; i < phrase.len; i++) {
+            if (!m_masks[i].check (phrase.pinyin_id[i].sheng, phrase.pinyin_id[i].yun))
+                return false;
+        }
+        return true;
+    }
+
+    const PhraseArray & phrases (void) const    { return m_phrases; }
+
+    /* Resets the statements, until more rows are fetched. */
+    void suspend (void) {
+        m_main.suspend ();
+        m_user.suspend ();
+    }
+
+private:
+    enum {
+        SOURCE_NONE,
+        SOURCE_PENDING,
+        SOURCE_HOT,
+        SOURCE_USER,
+        SOURCE_MAIN,
+    };
+
+    /* Chooses the source of the next row, and starts the statements
+     * unless a hot phrase surely goes first: no phrase is longer, and
+     * the user phrases of a larger user_freq are all hot. */
+    int next (void) {
+        bool hot = m_hot_pos < m_hot.size () && (m_hot_complete || !m_user.started ());
+
+        if (!hot || m_main.started () ||
+            (m_expected >> m_hot[m_hot_pos].len) != 0 ||
+            m_hot[m_hot_pos].user_freq <= m_hot_threshold) {
+            m_main.start ();
+            if (!m_hot_complete) {
+                m_user.start ();
+                hot = false;
+            }
+        }
+
+        /* the earlier sources go first when they tie, so a phrase in
+         * both databases is returned with its user_freq */
+        int source = SOURCE_NONE;
+        if (m_pending_pos < m_pending.size ())
+            source = SOURCE_PENDING;
+        if (hot)
+            source = choose (source, SOURCE_HOT);
+        if (m_user.valid ())
+            source = choose (source, SOURCE_USER);
+        if (m_main.valid ())
+            source = choose (source, SOURCE_MAIN);
+        return source;
+    }
+
+    int choose (int source, int other) {
+        if (source == SOURCE_NONE || !phrase_before (row (source), row (other)))
+            return other;
+        return source;
+    }
+
+    const Phrase & row (int source) const {
+        switch (source) {
+        case SOURCE_PENDING:
+            return m_pending[m_pending_pos];
+        case SOURCE_HOT:
+            return m_hot[m_hot_pos];
+        case SOURCE_USER:
+            return m_user.row ();
+        default:
+            return m_main.row ();
+        }
+    }
+
+    void advance (int source) {
+        switch (source) {
+        case SOURCE_PENDING:
+            m_pending_pos ++;
+            break;
+        case SOURCE_HOT:
+            m_hot_pos ++;
+            break;
+        case SOURCE_USER:
+            m_user.next ();
+            break;
+        default:
+            m_main.next ();
+            break;
+        }
+    }
+
+private:
+    std::vector<PinyinMask> m_masks;    /* masks of the pinyins of the span */
+    PhraseArray m_phrases;      /* candidates fetched so far */
+    QueryCursor m_main;
+    QueryCursor m_user;
+    PhraseArray m_pending;      /* pending updates of the span, sorted */
+    size_t m_pending_pos;
+    PhraseArray m_hot;          /* hot user phrases of the span, sorted */
+    size_t m_hot_pos;
+    unsigned int m_hot_threshold;
+    bool m_hot_complete;        /* m_hot has all user phrases of the span */
+    std::set<std::string> m_seen;   /* phrases returned of m_seen_len */
+    size_t m_seen_len;
+    unsigned int m_lengths;     /* lengths which are returned or known empty */
+    unsigned int m_expected;    /* lengths which passed the filter */
 };
 
 Query::Query (const PinyinArray    & pinyin,
@@ -150,7 +767,8 @@ Query::Query (const PinyinArray    & pinyin,
     : m_pinyin (pinyin),
       m_pinyin_begin (pinyin_begin),
       m_pinyin_len (pinyin_len),
-      m_option (option)
+      m_option (option),
+      m_pos (0)
 {
     g_assert (m_pinyin.size () >= pinyin_begin + pinyin_len);
 }
@@ -162,64 +780,116 @@ Query::~Query (void)
 int
 Query::fill (PhraseArray &phrases, int count)
 {
-    int row = 0;
-
-    while (m_pinyin_len > 0) {
-        if (G_LIKELY (m_stmt.get () == NULL)) {
-            m_stmt = Database::instance ().query (m_pinyin, m_pinyin_begin, m_pinyin_len, -1, m_option);
-            g_assert (m_stmt.get () != NULL);
-        }
-
-        while (m_stmt->step ()) {
-            Phrase phrase;
-
-            g_strlcpy (phrase.phrase,
-                       m_stmt->columnText (DB_COLUMN_PHRASE),
-                       sizeof (phrase.phrase));
-            phrase.freq = m_stmt->columnInt (DB_COLUMN_FREQ);
-            phrase.user_freq = m_stmt->columnInt (DB_COLUMN_USER_FREQ);
-            phrase.len = m_pinyin_len;
+    if (G_UNLIKELY (m_result.get () == NULL)) {
+        m_result = PhraseSource::instance ().lookup (m_pinyin, m_pinyin_begin, m_pinyin_len, m_option);
+    }
 
-            for (size_t i = 0, column = DB_COLUMN_S0; i < m_pinyin_len; i++) {
-                phrase.pinyin_id[i].sheng = m_stmt->columnInt (column++);
-                phrase.pinyin_id[i].yun = m_stmt->columnInt (column++);
-            }
+    /* One result holds the candidates of every length, the longest phrases
+     * first. Fewer rows than count means all rows are consumed. */
+    m_result->fetch (m_pos + count);
 
-            phrases.push_back (phrase);
-            row ++;
-            if (G_UNLIKELY (row == count)) {
-                return row;
-            }
-        }
+    const PhraseArray & result = m_result->phrases ();
+    int row = MIN ((size_t) count, result.size () - m_pos);
 
-        m_stmt.reset ();
-        m_pinyin_len --;
-    }
+    phrases.insert (phrases.end (),
+                    result.begin () + m_pos,
+                    result.begin () + m_pos + row);
+    m_pos += row;
 
     return row;
 }
 
-Database::Database (const std::string &user_data_dir)
+Database::Database (const std::string &user_data_dir, unsigned int flags)
     : m_db (NULL)
     , m_timeout_id (0)
+    , m_flush_id (0)
+    , m_compact_id (0)
     , m_timer (g_timer_new ())
     , m_user_data_dir (user_data_dir)
+    , m_flags (flags)
+    , m_lock_fd (-1)
+    , m_main_keyed (false)
+    , m_main_initials (0)
+    , m_user_initials (0)
+    , m_freq_total (0)
+    , m_stmt_cache_hits (0)
+    , m_stmt_cache_misses (0)
+    , m_query_stats_enabled (false)
+    , m_filter_checked (0)
+    , m_filter_skipped (0)
+    , m_filter_missed (0)
+    , m_result_cache_hits (0)
+    , m_result_cache_misses (0)
+    , m_pending_commits (0)
+    , m_user_limit (0)
+    , m_user_rows (0)
+    , m_user_generation (0)
+    , m_compact_threshold (-1)
+    , m_compact_scanning (false)
+    , m_compact_rowid (0)
+    , m_hot_size (DB_HOT_SIZE)
+    , m_hot_hits (0)
+    , m_hot_misses (0)
+    , m_thread (NULL)
+    , m_ready (0)
 {
-    open ();
+    /* the databases are opened in a thread, the first call of instance
+     * () waits for it; they are opened here if there is no thread */
+    GError *error = NULL;
+#if GLIB_CHECK_VERSION (2, 32, 0)
+    g_mutex_init (&m_thread_lock);
+    m_thread = g_thread_try_new ("pyzy-database", Database::openThread, this, &error);
+#else
+    if (!g_thread_supported ())
+        g_thread_init (NULL);
+    g_static_mutex_init (&m_thread_lock);
+    m_thread = g_thread_create (Database::openThread, this, TRUE, &error);
+#endif
+    if (m_thread == NULL) {
+        g_warning ("%s", error != NULL ? error->message : "can not create the database thread");
+        g_clear_error (&error);
+        openThread (this);
+    }
 }
 
 Database::~Database (void)
 {
+    /* the thread is joined even if it is done */
+    join ();
+#if GLIB_CHECK_VERSION (2, 32, 0)
+    g_mutex_clear (&m_thread_lock);
+#else
+    g_static_mutex_free (&m_thread_lock);
+#endif
+    if (m_flush_id != 0)
+        g_source_remove (m_flush_id);
+    flush ();
+    if (m_compact_id != 0)
+        g_source_remove (m_compact_id);
     g_timer_destroy (m_timer);
     if (m_timeout_id != 0) {
         saveUserDB ();
         g_source_remove (m_timeout_id);
     }
+    /* cached statements must be finalized before closing the database */
+    flushResults ();
+    m_stmt_cache.clear ();
+    for (size_t i = 0; i < WRITE_LAST; i++) {
+        for (size_t len = 0; len < MAX_PHRASE_LEN; len++)
+            m_write_stmts[i][len].reset ();
+    }
     if (m_db) {
+        if (!m_user_journal.empty ()) {
+            m_sql.printf ("PRAGMA userdb.journal_mode=%s;", m_user_journal.c_str ());
+            executeSQL (m_sql);
+        }
         if (sqlite3_close (m_db) != SQLITE_OK) {
             g_warning ("close sqlite database failed!");
         }
     }
+    /* closing the file releases the lock */
+    if (m_lock_fd >= 0)
+        close (m_lock_fd);
 }
 
 inline bool
@@ -237,6 +907,35 @@ Database::executeSQL (const char *sql, sqlite3 *db)
     return true;
 }
 
+gpointer
+Database::openThread (gpointer data)
+{
+    Database *self = static_cast<Database*> (data);
+
+    self->open ();
+    g_atomic_int_set (&self->m_ready, 1);
+    return NULL;
+}
+
+void
+Database::join (void)
+{
+#if GLIB_CHECK_VERSION (2, 32, 0)
+    g_mutex_lock (&m_thread_lock);
+#else
+    g_static_mutex_lock (&m_thread_lock);
+#endif
+    if (m_thread != NULL) {
+        g_thread_join (m_thread);
+        m_thread = NULL;
+    }
+#if GLIB_CHECK_VERSION (2, 32, 0)
+    g_mutex_unlock (&m_thread_lock);
+#else
+    g_static_mutex_unlock (&m_thread_lock);
+#endif
+}
+
 bool
 Database::open (void)
 {
@@ -255,6 +954,11 @@ Database::open (void)
         for (i = 0; i < G_N_ELEMENTS (maindb); i++) {
             if (!g_file_test(maindb[i], G_FILE_TEST_IS_REGULAR))
                 continue;
+            if (m_flags & INIT_MAIN_DB_SHARED) {
+                if (openShared (maindb[i]))
+                    break;
+                continue;
+            }
             if (sqlite3_open_v2 (maindb[i], &m_db,
                 SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) == SQLITE_OK) {
                 break;
@@ -266,6 +970,17 @@ Database::open (void)
             break;
         }
 
+        /* the main phrases are looked up in the compiled dictionary,
+         * unless the backend looks them up otherwise */
+        switch (m_flags & INIT_BACKEND_MASK) {
+        case INIT_BACKEND_AUTO:
+        case INIT_BACKEND_MAPPED:
+            openDict (maindb[i]);
+            break;
+        default:
+            break;
+        }
+
         m_sql.clear ();
 
         /* Set synchronous=OFF, write user database will become much faster.
@@ -274,8 +989,12 @@ Database::open (void)
          * */
         m_sql << "PRAGMA synchronous=OFF;\n";
 
-        /* Set the cache size for better performance */
-        m_sql << "PRAGMA cache_size=" DB_CACHE_SIZE ";\n";
+        /* Set the cache size for better performance. A shared main
+         * database is read from the mapped file instead. */
+        if (m_flags & INIT_MAIN_DB_SHARED)
+            m_sql << "PRAGMA main.mmap_size=" DB_MAIN_MMAP_SIZE ";\n";
+        else
+            m_sql << "PRAGMA cache_size=" DB_CACHE_SIZE ";\n";
 
         /* Using memory for temp store */
         // m_sql << "PRAGMA temp_store=MEMORY;\n";
@@ -289,7 +1008,30 @@ Database::open (void)
         if (!executeSQL (m_sql))
             break;
 
+        /* the keyed dictionary format has a packed syllable key column,
+         * see create_key_index.sql */
+        sqlite3_stmt *stmt;
+        m_main_keyed = sqlite3_prepare_v2 (m_db, "SELECT k FROM main.py_phrase_0",
+                                           -1, &stmt, NULL) == SQLITE_OK;
+        sqlite3_finalize (stmt);
+
         loadUserDB ();
+
+        /* create_index.sql and loadUserDB create the initials indexes,
+         * a main database of an older version may have none */
+        m_main_initials = initialsIndexes ("main");
+        m_user_initials = initialsIndexes ("userdb");
+
+        /* the first candidate scores its phrases against the total */
+        m_sql = "SELECT 0";
+        for (size_t i = 0; i < MAX_PHRASE_LEN; i++)
+            m_sql.appendPrintf ("+(SELECT total(freq) FROM main.py_phrase_%d)", (int) i);
+        SQLStmt total (m_db);
+        if (total.prepare (m_sql) && total.step ())
+            m_freq_total = total.columnInt64 (0);
+
+        buildFilter ();
+        loadHot ();
 #if 0
     /* Attach user database */
 
@@ -311,6 +1053,7 @@ Database::open (void)
         return true;
     } while (0);
 
+    m_dict.close ();
     if (m_db) {
         sqlite3_close (m_db);
         m_db = NULL;
@@ -318,44 +1061,156 @@ Database::open (void)
     return false;
 }
 
-bool
-Database::loadUserDB (void)
+/* Opens the compiled dictionary of the main database, see
+ * pyzy-compile-dict, which is next to it or in the user data directory.
+ * The mapped backend compiles it into the latter if there is none. */
+void
+Database::openDict (const char *source)
 {
-    sqlite3 *userdb = NULL;
-    do {
-        /* Attach user database */
-        m_sql.printf ("ATTACH DATABASE \":memory:\" AS userdb;");
-        if (!executeSQL (m_sql))
-            break;
+    m_buffer = source;
+    if (g_str_has_suffix (m_buffer, ".db"))
+        m_buffer.truncate (m_buffer.size () - 3);
+    m_buffer << ".dict";
+    if (m_dict.open (m_buffer, source))
+        return;
 
+    gchar *name = g_path_get_basename (m_buffer);
+    m_buffer.clear ();
+    m_buffer << m_user_data_dir << G_DIR_SEPARATOR_S << name;
+    g_free (name);
+    if (m_dict.open (m_buffer, source))
+        return;
+
+    if ((m_flags & INIT_BACKEND_MASK) == INIT_BACKEND_MAPPED) {
         g_mkdir_with_parents (m_user_data_dir, 0750);
-        m_buffer.clear ();
-        m_buffer << m_user_data_dir << G_DIR_SEPARATOR_S << USER_DICTIONARY_FILE;
+        if (MappedDictionary::compile (source, m_buffer))
+            m_dict.open (m_buffer, source);
+    }
+}
 
-        unsigned int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
-        if (sqlite3_open_v2 (m_buffer, &userdb, flags, NULL) != SQLITE_OK &&
-            sqlite3_open_v2 (":memory:", &userdb, flags, NULL) != SQLITE_OK)
-            break;
+/* Opens the main database read-only and immutable, so it takes no locks
+ * and is never changed. Its pages are read from the mapped file, which is
+ * shared with every other process reading it. The connection itself is
+ * read-write, for the attached user database. */
+bool
+Database::openShared (const char *path)
+{
+#if (SQLITE_VERSION_NUMBER >= 3008000)
+    String uri ("file:");
+    for (const char *p = path; *p != 0; p++) {
+        if (*p == '%' || *p == '?' || *p == '#')
+            uri.appendPrintf ("%%%02X", (unsigned char) *p);
+        else
+            uri << *p;
+    }
+    uri << "?mode=ro&immutable=1";
 
-        m_sql = "BEGIN TRANSACTION;\n";
-        /* create desc table*/
-        m_sql << "CREATE TABLE IF NOT EXISTS desc (name PRIMARY KEY, value TEXT);\n";
-        m_sql << "INSERT OR IGNORE INTO desc VALUES " << "('version', '1.2.0');\n"
-              << "INSERT OR IGNORE INTO desc VALUES " << "('uuid', '" << UUID () << "');\n"
-              << "INSERT OR IGNORE INTO desc VALUES " << "('hostname', '" << Hostname () << "');\n"
-              << "INSERT OR IGNORE INTO desc VALUES " << "('username', '" << Env ("USERNAME") << "');\n"
-              << "INSERT OR IGNORE INTO desc VALUES " << "('create-time', datetime());\n"
-              << "INSERT OR IGNORE INTO desc VALUES " << "('attach-time', datetime());\n";
+    if (sqlite3_open_v2 (uri, &m_db,
+                         SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI,
+                         NULL) == SQLITE_OK)
+        return true;
 
-        /* create phrase tables */
-        for (size_t i = 0; i < MAX_PHRASE_LEN; i++) {
-            m_sql.appendPrintf ("CREATE TABLE IF NOT EXISTS py_phrase_%d (user_freq, phrase TEXT, freq INTEGER ", i);
-            for (size_t j = 0; j <= i; j++)
-                m_sql.appendPrintf (",s%d INTEGER, y%d INTEGER", j, j);
-            m_sql << ");\n";
-        }
+    g_warning ("Can not open main database %s: %s", path, sqlite3_errmsg (m_db));
+    sqlite3_close (m_db);
+    m_db = NULL;
+    return false;
+#else
+    /* no immutable databases, open it as usual */
+    m_flags &= ~INIT_MAIN_DB_SHARED;
+    return sqlite3_open_v2 (path, &m_db,
+                            SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) == SQLITE_OK;
+#endif
+}
 
-        /* create index */
+bool
+Database::attachUserDB (const char *path)
+{
+    sqlite3_stmt *stmt = NULL;
+    bool retval = false;
+
+    if (sqlite3_prepare_v2 (m_db, "ATTACH DATABASE ? AS userdb", -1, &stmt, NULL) == SQLITE_OK &&
+        sqlite3_bind_text (stmt, 1, path, -1, SQLITE_TRANSIENT) == SQLITE_OK &&
+        sqlite3_step (stmt) == SQLITE_DONE) {
+        retval = true;
+    }
+    else {
+        g_warning ("Can not attach user database %s: %s", path, sqlite3_errmsg (m_db));
+    }
+    sqlite3_finalize (stmt);
+
+    if (!retval)
+        return false;
+
+    /* Every flush of the pending phrases appends to the write-ahead log,
+     * so writing is proportional to the change, and a crash of the
+     * process loses only the phrases still pending. Unlike the main
+     * database, the file may be shared with other processes, so it is not
+     * locked exclusively. The file may belong to a process which keeps
+     * it in memory, so its journal mode is set back at the end. */
+    if (sqlite3_prepare_v2 (m_db, "PRAGMA userdb.journal_mode", -1, &stmt, NULL) == SQLITE_OK &&
+        sqlite3_step (stmt) == SQLITE_ROW) {
+        const char *mode = (const char *) sqlite3_column_text (stmt, 0);
+        if (mode != NULL && g_ascii_strcasecmp (mode, "wal") != 0)
+            m_user_journal = mode;
+    }
+    sqlite3_finalize (stmt);
+
+    m_sql.clear ();
+    m_sql << "PRAGMA userdb.locking_mode=NORMAL;\n";
+    m_sql << "PRAGMA userdb.journal_mode=WAL;\n";
+    m_sql << "PRAGMA userdb.synchronous=NORMAL;\n";
+    m_sql << "PRAGMA userdb.mmap_size=" DB_MMAP_SIZE ";\n";
+    return executeSQL (m_sql);
+}
+
+bool
+Database::loadUserDB (void)
+{
+    sqlite3 *userdb = NULL;
+    do {
+        g_mkdir_with_parents (m_user_data_dir, 0750);
+
+        /* the copy in memory is written over the file later, see
+         * USER_DB_LOCK_FILE */
+        if (!(m_flags & INIT_USER_DB_ON_DISK)) {
+            m_buffer.clear ();
+            m_buffer << m_user_data_dir << G_DIR_SEPARATOR_S << USER_DB_LOCK_FILE;
+            m_lock_fd = g_open (m_buffer, O_RDWR | O_CREAT, 0600);
+            if (m_lock_fd >= 0 && flock (m_lock_fd, LOCK_SH | LOCK_NB) != 0)
+                g_warning ("Another process is changing the user database in %s",
+                           (const char *) m_user_data_dir);
+        }
+
+        m_buffer.clear ();
+        m_buffer << m_user_data_dir << G_DIR_SEPARATOR_S << USER_DICTIONARY_FILE;
+
+        unsigned int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+        if (sqlite3_open_v2 (m_buffer, &userdb, flags, NULL) != SQLITE_OK) {
+            /* keep the user database in memory only */
+            m_flags &= ~INIT_USER_DB_ON_DISK;
+            if (sqlite3_open_v2 (":memory:", &userdb, flags, NULL) != SQLITE_OK)
+                break;
+        }
+
+        m_sql = "BEGIN TRANSACTION;\n";
+        /* create desc table*/
+        m_sql << "CREATE TABLE IF NOT EXISTS desc (name PRIMARY KEY, value TEXT);\n";
+        m_sql << "INSERT OR IGNORE INTO desc VALUES " << "('version', '1.2.0');\n"
+              << "INSERT OR IGNORE INTO desc VALUES " << "('uuid', '" << UUID () << "');\n"
+              << "INSERT OR IGNORE INTO desc VALUES " << "('hostname', '" << Hostname () << "');\n"
+              << "INSERT OR IGNORE INTO desc VALUES " << "('username', '" << Env ("USERNAME") << "');\n"
+              << "INSERT OR IGNORE INTO desc VALUES " << "('create-time', datetime());\n"
+              << "INSERT OR IGNORE INTO desc VALUES " << "('attach-time', datetime());\n";
+
+        /* create phrase tables */
+        for (size_t i = 0; i < MAX_PHRASE_LEN; i++) {
+            m_sql.appendPrintf ("CREATE TABLE IF NOT EXISTS py_phrase_%d (user_freq, phrase TEXT, freq INTEGER ", (int) i);
+            for (size_t j = 0; j <= i; j++)
+                m_sql.appendPrintf (",s%d INTEGER, y%d INTEGER", (int) j, (int) j);
+            m_sql << ",atime INTEGER DEFAULT 0);\n";
+        }
+
+        /* create index */
         m_sql << "CREATE UNIQUE INDEX IF NOT EXISTS " << "index_0_0 ON py_phrase_0(s0,y0,phrase);\n";
         m_sql << "CREATE UNIQUE INDEX IF NOT EXISTS " << "index_1_0 ON py_phrase_1(s0,y0,s1,y1,phrase);\n";
         m_sql << "CREATE INDEX IF NOT EXISTS " << "index_1_1 ON py_phrase_1(s0,s1,y1);\n";
@@ -372,6 +1227,48 @@ Database::loadUserDB (void)
         if (!executeSQL (m_sql, userdb))
             break;
 
+        /* the initials indexes of older versions were on expressions,
+         * which sqlite before 3.9 can not read, they are replaced by
+         * indexes on the sheng columns */
+        m_sql = "BEGIN TRANSACTION;\n";
+        for (size_t i = 1; i < MAX_PHRASE_LEN; i++) {
+            m_sql << "DROP INDEX IF EXISTS " << "index_" << i << "_i;\n";
+            m_sql << "CREATE INDEX IF NOT EXISTS " << "index_" << i << "_s ON py_phrase_" << i << "(s0";
+            for (size_t j = 1; j <= i; j++)
+                m_sql << ",s" << j;
+            m_sql << ");\n";
+        }
+        m_sql << "COMMIT;";
+        if (!executeSQL (m_sql, userdb))
+            executeSQL ("ROLLBACK;", userdb);
+
+        /* user databases of older versions have no atime column, their
+         * phrases are taken as committed now */
+        sqlite3_stmt *stmt;
+        bool has_atime = sqlite3_prepare_v2 (userdb, "SELECT atime FROM py_phrase_0",
+                                             -1, &stmt, NULL) == SQLITE_OK;
+        sqlite3_finalize (stmt);
+        if (!has_atime) {
+            m_sql = "BEGIN TRANSACTION;\n";
+            for (size_t i = 0; i < MAX_PHRASE_LEN; i++) {
+                m_sql.appendPrintf ("ALTER TABLE py_phrase_%d ADD COLUMN atime INTEGER DEFAULT 0;\n", (int) i);
+                m_sql.appendPrintf ("UPDATE py_phrase_%d SET atime=%ld;\n", (int) i, (long) std::time (NULL));
+            }
+            m_sql << "COMMIT;";
+            if (!executeSQL (m_sql, userdb))
+                break;
+        }
+
+        if (m_flags & INIT_USER_DB_ON_DISK) {
+            sqlite3_close (userdb);
+            return attachUserDB (m_buffer);
+        }
+
+        /* Attach user database */
+        m_sql.printf ("ATTACH DATABASE \":memory:\" AS userdb;");
+        if (!executeSQL (m_sql))
+            break;
+
         sqlite3_backup *backup = sqlite3_backup_init (m_db, "userdb", userdb, "main");
 
         if (backup) {
@@ -391,6 +1288,11 @@ Database::loadUserDB (void)
 bool
 Database::saveUserDB (void)
 {
+    /* the user database on disk is always up to date */
+    if (m_flags & INIT_USER_DB_ON_DISK)
+        return true;
+
+    flush ();
     g_mkdir_with_parents (m_user_data_dir, 0750);
     m_buffer.clear ();
     m_buffer << m_user_data_dir << G_DIR_SEPARATOR_S << USER_DICTIONARY_FILE;
@@ -438,6 +1340,168 @@ Database::prefetch (void)
     // g_debug ("done");
 }
 
+void
+Database::buildFilter (void)
+{
+    static const char *dbs[] = { "main", "userdb" };
+    std::vector<guint64> keys;
+    int sheng[DB_FILTER_DEPTH];
+    int yun[DB_FILTER_DEPTH];
+
+    m_filter.clear ();
+    for (size_t i = 0; i < G_N_ELEMENTS (dbs); i++) {
+        if (i == 0 && m_dict.opened ()) {
+            buildFilterFromDict (keys);
+            continue;
+        }
+
+        for (size_t len = 1; len <= MAX_PHRASE_LEN; len++) {
+            size_t depth = MIN (len, DB_FILTER_DEPTH);
+
+            /* both scans are answered by the covering indexes */
+            for (int kind = DB_FILTER_FULL; kind <= DB_FILTER_SHENG; kind++) {
+                m_sql = "SELECT DISTINCT s0";
+                for (size_t j = 0; j < depth; j++) {
+                    if (j > 0)
+                        m_sql << ",s" << j;
+                    if (kind == DB_FILTER_FULL)
+                        m_sql << ",y" << j;
+                }
+                m_sql << " FROM " << dbs[i] << ".py_phrase_" << len - 1;
+
+                SQLStmt stmt (m_db);
+                if (!stmt.prepare (m_sql))
+                    continue;
+                while (stmt.step ()) {
+                    for (size_t j = 0, column = 0; j < depth; j++) {
+                        sheng[j] = stmt.columnInt (column++);
+                        yun[j] = kind == DB_FILTER_FULL ? stmt.columnInt (column++) : 0;
+                    }
+                    keys.push_back (filter_key (kind, len, sheng, yun));
+                }
+            }
+        }
+    }
+
+    m_filter.reset (keys.size () + DB_FILTER_RESERVE);
+    for (size_t i = 0; i < keys.size (); i++)
+        m_filter.insert (keys[i]);
+}
+
+/* The rows of the compiled dictionary are sorted by the syllables, so the
+ * rows of the same key are next to each other. */
+void
+Database::buildFilterFromDict (std::vector<guint64> & keys)
+{
+    int sheng[DB_FILTER_DEPTH];
+    int yun[DB_FILTER_DEPTH];
+
+    for (size_t len = 1; len <= MAX_PHRASE_LEN; len++) {
+        size_t depth = MIN (len, DB_FILTER_DEPTH);
+        guint64 last[DB_FILTER_SHENG + 1] = { 0 };
+
+        for (size_t row = 0; row < m_dict.rows (len); row++) {
+            for (size_t j = 0; j < depth; j++) {
+                guint16 syllable = m_dict.syllable (len, row, j);
+                sheng[j] = MAPPED_DICT_SHENG (syllable);
+                yun[j] = MAPPED_DICT_YUN (syllable);
+            }
+            for (int kind = DB_FILTER_FULL; kind <= DB_FILTER_SHENG; kind++) {
+                guint64 key = filter_key (kind, len, sheng, yun);
+                if (key != last[kind])
+                    keys.push_back (key);
+                last[kind] = key;
+            }
+        }
+    }
+}
+
+void
+Database::filterInsert (const Phrase & phrase)
+{
+    int sheng[DB_FILTER_DEPTH];
+    int yun[DB_FILTER_DEPTH];
+
+    for (size_t i = 0; i < MIN (phrase.len, DB_FILTER_DEPTH); i++) {
+        sheng[i] = phrase.pinyin_id[i].sheng;
+        yun[i] = phrase.pinyin_id[i].yun;
+    }
+    m_filter.insert (filter_key (DB_FILTER_FULL, phrase.len, sheng, yun));
+    m_filter.insert (filter_key (DB_FILTER_SHENG, phrase.len, sheng, yun));
+}
+
+bool
+Database::filterContains (const PinyinArray &pinyin,
+                          size_t             pinyin_begin,
+                          size_t             len,
+                          const int         *modes)
+{
+    size_t depth = MIN (len, DB_FILTER_DEPTH);
+    int kind = DB_FILTER_FULL;
+    int sheng[DB_FILTER_DEPTH][3];
+    int yun[DB_FILTER_DEPTH][2];
+    size_t sheng_size[DB_FILTER_DEPTH];
+    size_t yun_size[DB_FILTER_DEPTH];
+
+    /* the acceptable ids of every syllable, as in the where clause */
+    for (size_t i = 0; i < depth; i++) {
+        const Pinyin *p = pinyin[pinyin_begin + i];
+        int mode_sheng = modes[i] / 3;
+        int mode_yun = modes[i] % 3;
+
+        sheng_size[i] = 0;
+        sheng[i][sheng_size[i]++] = p->pinyin_id[0].sheng;
+        if (mode_sheng & 1)
+            sheng[i][sheng_size[i]++] = p->pinyin_id[1].sheng;
+        if (mode_sheng & 2)
+            sheng[i][sheng_size[i]++] = p->pinyin_id[2].sheng;
+
+        yun_size[i] = 0;
+        yun[i][yun_size[i]++] = p->pinyin_id[0].yun;
+        if (mode_yun == 2)
+            yun[i][yun_size[i]++] = p->pinyin_id[1].yun;
+        if (mode_yun == 0)
+            kind = DB_FILTER_SHENG;
+    }
+
+    /* try every combination of the acceptable ids */
+    size_t index[DB_FILTER_DEPTH * 2] = { 0 };
+    while (true) {
+        int s[DB_FILTER_DEPTH];
+        int y[DB_FILTER_DEPTH];
+        for (size_t i = 0; i < depth; i++) {
+            s[i] = sheng[i][index[i * 2]];
+            y[i] = yun[i][index[i * 2 + 1]];
+        }
+        if (m_filter.contains (filter_key (kind, len, s, y)))
+            return true;
+
+        size_t i;
+        for (i = 0; i < depth * 2; i++) {
+            size_t size = (i % 2 == 0) ? sheng_size[i / 2] :
+                          (kind == DB_FILTER_FULL ? yun_size[i / 2] : 1);
+            if (++index[i] < size)
+                break;
+            index[i] = 0;
+        }
+        if (i == depth * 2)
+            return false;
+    }
+}
+
+Database::FilterStats
+Database::filterStats (void) const
+{
+    FilterStats stats;
+    stats.checked = m_filter_checked;
+    stats.skipped = m_filter_skipped;
+    stats.missed = m_filter_missed;
+    stats.keys = m_filter.count ();
+    stats.bytes = m_filter.bytes ();
+    stats.fp_rate = m_filter.falsePositiveRate ();
+    return stats;
+}
+
 // This function should be return gboolean because g_timeout_add_seconds requires it.
 gboolean
 Database::timeoutCallback (void * data)
@@ -459,6 +1523,9 @@ Database::timeoutCallback (void * data)
 void
 Database::modified (void)
 {
+    if (m_flags & INIT_USER_DB_ON_DISK)
+        return;
+
     /* Restart the timer */
     g_timer_start (m_timer);
 
@@ -470,181 +1537,589 @@ Database::modified (void)
                                           static_cast<void *> (this));
 }
 
-inline static bool
-pinyin_option_check_sheng (unsigned int option, unsigned int id, unsigned int fid)
-{
-    switch ((id << 16) | fid) {
-    case (PINYIN_ID_C << 16) | PINYIN_ID_CH:
-        return (option & PINYIN_FUZZY_C_CH);
-    case (PINYIN_ID_CH << 16) | PINYIN_ID_C:
-        return (option & PINYIN_FUZZY_CH_C);
-    case (PINYIN_ID_Z << 16) | PINYIN_ID_ZH:
-        return (option & PINYIN_FUZZY_Z_ZH);
-    case (PINYIN_ID_ZH << 16) | PINYIN_ID_Z:
-        return (option & PINYIN_FUZZY_ZH_Z);
-    case (PINYIN_ID_S << 16) | PINYIN_ID_SH:
-        return (option & PINYIN_FUZZY_S_SH);
-    case (PINYIN_ID_SH << 16) | PINYIN_ID_S:
-        return (option & PINYIN_FUZZY_SH_S);
-    case (PINYIN_ID_L << 16) | PINYIN_ID_N:
-        return (option & PINYIN_FUZZY_L_N);
-    case (PINYIN_ID_N << 16) | PINYIN_ID_L:
-        return (option & PINYIN_FUZZY_N_L);
-    case (PINYIN_ID_F << 16) | PINYIN_ID_H:
-        return (option & PINYIN_FUZZY_F_H);
-    case (PINYIN_ID_H << 16) | PINYIN_ID_F:
-        return (option & PINYIN_FUZZY_H_F);
-    case (PINYIN_ID_L << 16) | PINYIN_ID_R:
-        return (option & PINYIN_FUZZY_L_R);
-    case (PINYIN_ID_R << 16) | PINYIN_ID_L:
-        return (option & PINYIN_FUZZY_R_L);
-    case (PINYIN_ID_K << 16) | PINYIN_ID_G:
-        return (option & PINYIN_FUZZY_K_G);
-    case (PINYIN_ID_G << 16) | PINYIN_ID_K:
-        return (option & PINYIN_FUZZY_G_K);
-    default: return false;
-    }
-}
-
-inline static bool
-pinyin_option_check_yun (unsigned int option, unsigned int id, unsigned int fid)
-{
-    switch ((id << 16) | fid) {
-    case (PINYIN_ID_AN << 16) | PINYIN_ID_ANG:
-        return (option & PINYIN_FUZZY_AN_ANG);
-    case (PINYIN_ID_ANG << 16) | PINYIN_ID_AN:
-        return (option & PINYIN_FUZZY_ANG_AN);
-    case (PINYIN_ID_EN << 16) | PINYIN_ID_ENG:
-        return (option & PINYIN_FUZZY_EN_ENG);
-    case (PINYIN_ID_ENG << 16) | PINYIN_ID_EN:
-        return (option & PINYIN_FUZZY_ENG_EN);
-    case (PINYIN_ID_IN << 16) | PINYIN_ID_ING:
-        return (option & PINYIN_FUZZY_IN_ING);
-    case (PINYIN_ID_ING << 16) | PINYIN_ID_IN:
-        return (option & PINYIN_FUZZY_ING_IN);
-    case (PINYIN_ID_IAN << 16) | PINYIN_ID_IANG:
-        return (option & PINYIN_FUZZY_IAN_IANG);
-    case (PINYIN_ID_IANG << 16) | PINYIN_ID_IAN:
-        return (option & PINYIN_FUZZY_IANG_IAN);
-    case (PINYIN_ID_UAN << 16) | PINYIN_ID_UANG:
-        return (option & PINYIN_FUZZY_UAN_UANG);
-    case (PINYIN_ID_UANG << 16) | PINYIN_ID_UAN:
-        return (option & PINYIN_FUZZY_UANG_UAN);
-    default: return false;
+PhraseResultPtr
+Database::lookup (const PinyinArray &pinyin,
+                  size_t             pinyin_begin,
+                  size_t             pinyin_len,
+                  unsigned int       option)
+{
+    /* results are keyed by the option and the ids of every pinyin */
+    std::string key ((const char *) &option, sizeof (option));
+    for (size_t i = 0; i < pinyin_len; i++) {
+        const Pinyin *p = pinyin[i + pinyin_begin];
+        key.append ((const char *) p->pinyin_id, sizeof (p->pinyin_id));
+    }
+
+    ResultIndex::iterator it = m_result_index.find (key);
+    if (it != m_result_index.end ()) {
+        /* move it to the front of the lru list */
+        m_results.splice (m_results.begin (), m_results, it->second);
+        m_result_cache_hits ++;
+        return it->second->second;
+    }
+
+    QueryResultPtr result (new QueryResult (pinyin, pinyin_begin, pinyin_len, option));
+    if (pinyin_len > 0 && m_hot.enabled ())
+        result->setHot (m_hot);
+    for (PendingMap::const_iterator it = m_pending.begin (); it != m_pending.end (); ++it) {
+        if (result->matches (it->second.phrase))
+            result->addPending (it->second.phrase);
+    }
+    /* the statements are NULL if the filter proved that no phrase matches */
+    if (pinyin_len > 0) {
+        SQLStmtPtr main_stmt;
+        SQLStmtPtr user_stmt;
+        PhraseArray main_phrases;
+        unsigned int lengths = query (pinyin, pinyin_begin, pinyin_len, -1, option,
+                                      main_stmt, user_stmt, &main_phrases);
+        result->setStmts (main_stmt, user_stmt, lengths);
+        if (!main_phrases.empty ())
+            result->setMainPhrases (main_phrases);
+    }
+    m_result_cache_misses ++;
+
+    m_results.push_front (std::make_pair (key, result));
+    m_result_index[key] = m_results.begin ();
+    if (m_results.size () > DB_RESULT_CACHE_SIZE) {
+        m_result_index.erase (m_results.back ().first);
+        m_results.pop_back ();
+    }
+
+    /* the statements of the results are reset when the input is idle */
+    if (m_flush_id == 0)
+        m_flush_id = g_timeout_add_seconds (DB_FLUSH_TIMEOUT,
+                                            Database::flushCallback,
+                                            static_cast<void *> (this));
+
+    return result;
+}
+
+void
+Database::flushResults (void)
+{
+    m_results.clear ();
+    m_result_index.clear ();
+}
+
+void
+Database::suspendResults (void)
+{
+    for (ResultList::iterator it = m_results.begin (); it != m_results.end (); ++it)
+        it->second->suspend ();
+}
+
+void
+Database::setQueryStats (bool enable)
+{
+    if (enable && !m_query_stats_enabled)
+        m_query_stats.clear ();
+    m_query_stats_enabled = enable;
+
+    /* the cached statements stop recording at once */
+    if (!enable) {
+        for (StmtCache::iterator it = m_stmt_cache.begin (); it != m_stmt_cache.end (); ++it)
+            it->second->setStats (QueryStatsPtr ());
     }
 }
 
-SQLStmtPtr
+static bool
+query_stats_slower (const std::pair<std::string, QueryStatsPtr> & a,
+                    const std::pair<std::string, QueryStatsPtr> & b)
+{
+    return a.second->step_ns > b.second->step_ns;
+}
+
+std::string
+Database::queryStatsReport (void)
+{
+    std::vector<std::pair<std::string, QueryStatsPtr> > stats (m_query_stats.begin (),
+                                                                m_query_stats.end ());
+    std::sort (stats.begin (), stats.end (), query_stats_slower);
+
+    String report;
+    report.appendPrintf ("%-18s %8s %8s %10s %8s %8s %9s %6s %7s %10s %7s %7s %7s %s\n",
+                         "shape", "execs", "prepares", "prepare_us", "steps", "rows",
+                         "fullscans", "sorts", "autoidx", "step_us",
+                         "p50_us", "p90_us", "p99_us", "example");
+    for (size_t i = 0; i < stats.size (); i++) {
+        const QueryStats & s = *stats[i].second;
+        char percentiles[3][24];
+        static const double ps[] = { 50, 90, 99 };
+
+        for (size_t j = 0; j < G_N_ELEMENTS (ps); j++) {
+            guint64 us = s.percentile (ps[j]);
+            if (s.executions == 0)
+                g_strlcpy (percentiles[j], "-", sizeof (percentiles[j]));
+            else if (us == G_MAXUINT64)
+                g_snprintf (percentiles[j], sizeof (percentiles[j]), ">%" G_GUINT64_FORMAT,
+                            (guint64) 1 << (QUERY_STATS_BUCKETS - 2));
+            else
+                g_snprintf (percentiles[j], sizeof (percentiles[j]), "%" G_GUINT64_FORMAT, us);
+        }
+
+        report.appendPrintf ("%-18s %8lu %8lu %10" G_GUINT64_FORMAT " %8lu %8lu %9lu %6lu %7lu "
+                             "%10" G_GUINT64_FORMAT " %7s %7s %7s %s\n",
+                             stats[i].first.c_str (), s.executions, s.prepares,
+                             s.prepare_ns / 1000, s.steps, s.rows,
+                             s.fullscan_steps, s.sorts, s.autoindexes, s.step_ns / 1000,
+                             percentiles[0], percentiles[1], percentiles[2],
+                             s.example.c_str ());
+    }
+    return report;
+}
+
+void
+Database::invalidateResults (const Phrase & phrase)
+{
+    for (ResultList::iterator it = m_results.begin (); it != m_results.end ();) {
+        if (it->second->matches (phrase)) {
+            m_result_index.erase (it->first);
+            it = m_results.erase (it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+unsigned int
 Database::query (const PinyinArray &pinyin,
                  size_t             pinyin_begin,
                  size_t             pinyin_len,
                  int                m,
-                 unsigned int       option)
+                 unsigned int       option,
+                 SQLStmtPtr        &main_stmt,
+                 SQLStmtPtr        &user_stmt,
+                 PhraseArray       *main_phrases)
 {
     g_assert (pinyin_begin < pinyin.size ());
     g_assert (pinyin_len <= pinyin.size () - pinyin_begin);
     g_assert (pinyin_len <= MAX_PHRASE_LEN);
 
-    /* prepare sql */
-    Conditions conditions;
-
+    /* The shape of the query, one char per pinyin: which fuzzy shengs are
+     * used, whether the yun is absent, exact or fuzzy, and whether phrases
+     * of that length may exist. Queries with the same shape share one
+     * prepared statement, only the ids are rebound. */
+    const PinyinOptionTable & table = PinyinOptionTable::get (option);
+    int modes[MAX_PHRASE_LEN];
     for (size_t i = 0; i < pinyin_len; i++) {
-        const Pinyin *p;
-        bool fs1, fs2;
-        p = pinyin[i + pinyin_begin];
+        const Pinyin *p = pinyin[i + pinyin_begin];
+        guint64 fuzzy_sheng = table.sheng (p->pinyin_id[0].sheng);
+        int sheng = 0;
+        int yun = 0;
 
-        fs1 = pinyin_option_check_sheng (option, p->pinyin_id[0].sheng, p->pinyin_id[1].sheng);
-        fs2 = pinyin_option_check_sheng (option, p->pinyin_id[0].sheng, p->pinyin_id[2].sheng);
+        if (fuzzy_sheng & PINYIN_ID_BIT (p->pinyin_id[1].sheng))
+            sheng |= 1;
+        if (fuzzy_sheng & PINYIN_ID_BIT (p->pinyin_id[2].sheng))
+            sheng |= 2;
 
-        if (G_LIKELY (i > 0))
-            conditions.appendPrintf (0, conditions.size (),
-                                       " AND ");
-
-        if (G_UNLIKELY (fs1 || fs2)) {
-            if (G_LIKELY (i < DB_INDEX_SIZE)) {
-                if (fs1 && fs2 == 0) {
-                    conditions.double_ ();
-                    conditions.appendPrintf (0, conditions.size ()  >> 1,
-                                               "s%d=%d", i, p->pinyin_id[0].sheng);
-                    conditions.appendPrintf (conditions.size () >> 1, conditions.size (),
-                                               "s%d=%d", i, p->pinyin_id[1].sheng);
-                }
-                else if (fs1 == 0 && fs2) {
-                    conditions.double_ ();
-                    conditions.appendPrintf (0, conditions.size ()  >> 1,
-                                               "s%d=%d", i, p->pinyin_id[0].sheng);
-                    conditions.appendPrintf (conditions.size () >> 1, conditions.size (),
-                                               "s%d=%d", i, p->pinyin_id[2].sheng);
-                }
-                else {
-                    size_t len = conditions.size ();
-                    conditions.triple ();
-                    conditions.appendPrintf (0, len,
-                                               "s%d=%d", i, p->pinyin_id[0].sheng);
-                    conditions.appendPrintf (len, len << 1,
-                                               "s%d=%d", i, p->pinyin_id[1].sheng);
-                    conditions.appendPrintf (len << 1, conditions.size (),
-                                               "s%d=%d", i, p->pinyin_id[2].sheng);
-                }
+        if (p->pinyin_id[0].yun != PINYIN_ID_ZERO) {
+            yun = (table.yun (p->pinyin_id[0].yun) & PINYIN_ID_BIT (p->pinyin_id[1].yun)) ? 2 : 1;
+        }
+
+        modes[i] = sheng * 3 + yun;
+    }
+
+    /* skip the lengths which can not have any phrase */
+    String key (pinyin_len);
+    size_t max_len = 0;
+    unsigned int lengths = 0;
+    for (size_t len = 1; len <= pinyin_len; len++) {
+        bool exists = filterContains (pinyin, pinyin_begin, len, modes);
+
+        m_filter_checked ++;
+        if (exists) {
+            max_len = len;
+            lengths |= 1U << (len - 1);
+        }
+        else {
+            m_filter_skipped ++;
+        }
+        key << SHAPE_CHAR (modes[len - 1], exists);
+    }
+
+    if (max_len == 0)
+        return 0;
+
+    if (main_phrases != NULL && m_dict.opened ())
+        lookupDict (key, pinyin, pinyin_begin, max_len, modes, *main_phrases);
+    else
+        main_stmt = prepareQuery (DB_QUERY_MAIN, key, pinyin, pinyin_begin, max_len, modes, m);
+    /* the complete hot set has every user phrase */
+    if (!m_hot.complete ())
+        user_stmt = prepareQuery (DB_QUERY_USER, key, pinyin, pinyin_begin, max_len, modes, m);
+    return lengths;
+}
+
+void
+Database::lookupDict (const std::string & shape,
+                      const PinyinArray & pinyin,
+                      size_t              pinyin_begin,
+                      size_t              max_len,
+                      const int          *modes,
+                      PhraseArray       & phrases)
+{
+    MappedDictionary::Syllable syllables[MAX_PHRASE_LEN];
+
+    for (size_t i = 0; i < max_len; i++) {
+        const Pinyin *p = pinyin[i + pinyin_begin];
+        MappedDictionary::Syllable & s = syllables[i];
+        int sheng = modes[i] / 3;
+        int yun = modes[i] % 3;
+
+        s.nsheng = 0;
+        s.shengs[s.nsheng++] = p->pinyin_id[0].sheng;
+        if (sheng & 1)
+            s.shengs[s.nsheng++] = p->pinyin_id[1].sheng;
+        if (sheng & 2)
+            s.shengs[s.nsheng++] = p->pinyin_id[2].sheng;
+
+        s.nyun = 0;
+        if (yun > 0)
+            s.yuns[s.nyun++] = p->pinyin_id[0].yun;
+        if (yun > 1)
+            s.yuns[s.nyun++] = p->pinyin_id[1].yun;
+
+        s.mask.sheng = 0;
+        for (size_t j = 0; j < s.nsheng; j++)
+            s.mask.sheng |= PINYIN_ID_BIT (s.shengs[j]);
+        s.mask.yun = s.nyun == 0 ? ~G_GUINT64_CONSTANT (0) : 0;
+        for (size_t j = 0; j < s.nyun; j++)
+            s.mask.yun |= PINYIN_ID_BIT (s.yuns[j]);
+    }
+
+    /* the longest phrases first, as the statements return them */
+    for (size_t len = max_len; len > 0; len--) {
+        if (SHAPE_HAS_LEN (shape[len - 1]))
+            m_dict.lookup (syllables, len, phrases);
+    }
+}
+
+SQLStmtPtr
+Database::prepareQuery (char                db,
+                        const std::string & shape,
+                        const PinyinArray & pinyin,
+                        size_t              pinyin_begin,
+                        size_t              max_len,
+                        const int          *modes,
+                        int                 m)
+{
+    std::string key (1, db);
+    key += shape;
+
+    SQLStmtPtr stmt;
+    StmtCache::iterator it = m_stmt_cache.find (key);
+
+    /* a cached statement may still be stepped by another Query */
+    QueryStatsPtr stats;
+    if (G_UNLIKELY (m_query_stats_enabled)) {
+        QueryStatsPtr & ptr = m_query_stats[key];
+        if (ptr.get () == NULL) {
+            ptr.reset (new QueryStats ());
+            for (size_t i = 0; i < shape.size (); i++) {
+                if (i > 0)
+                    ptr->example += '\'';
+                ptr->example += pinyin[i + pinyin_begin]->text;
             }
-            else {
-                if (fs1 && fs2 == 0) {
-                    conditions.appendPrintf (0, conditions.size (),
-                                               "s%d IN (%d,%d)", i, p->pinyin_id[0].sheng, p->pinyin_id[1].sheng);
-                }
-                else if (fs1 == 0 && fs2) {
-                    conditions.appendPrintf (0, conditions.size (),
-                                               "s%d IN (%d,%d)", i, p->pinyin_id[0].sheng, p->pinyin_id[2].sheng);
-                }
-                else {
-                    conditions.appendPrintf (0, conditions.size (),
-                                               "s%d IN (%d,%d,%d)", i, p->pinyin_id[0].sheng, p->pinyin_id[1].sheng, p->pinyin_id[2].sheng);
-                }
+        }
+        stats = ptr;
+    }
+
+    if (it != m_stmt_cache.end () && it->second.use_count () == 1) {
+        stmt = it->second;
+        stmt->reset ();
+        m_stmt_cache_hits ++;
+    }
+    else {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+        stmt = buildQuery (db, shape);
+        if (stmt.get () == NULL)
+            return stmt;
+        m_stmt_cache_misses ++;
+        if (stats.get () != NULL) {
+            stats->prepares ++;
+            stats->prepare_ns += std::chrono::duration_cast<std::chrono::nanoseconds> (
+                                     std::chrono::steady_clock::now () - start).count ();
+        }
+
+        if (m_stmt_cache.size () >= DB_STMT_CACHE_SIZE) {
+            /* drop the statements which are not in use */
+            for (StmtCache::iterator i = m_stmt_cache.begin (); i != m_stmt_cache.end ();) {
+                if (i->second.use_count () == 1)
+                    m_stmt_cache.erase (i++);
+                else
+                    ++i;
             }
         }
+        if (m_stmt_cache.size () < DB_STMT_CACHE_SIZE)
+            m_stmt_cache[key] = stmt;
+    }
+
+    stmt->setStats (stats);
+
+    /* bind sheng and yun ids, the pinyins after the longest phrase
+     * are not referred by the statement */
+    stmt->bindInt (DB_PARAM_LIMIT, m > 0 ? m : -1);
+    /* every row is after a phrase longer than the longest one */
+    stmt->bindInt (DB_PARAM_AFTER_LEN, MAX_PHRASE_LEN + 1);
+    for (size_t i = 0; i < max_len; i++) {
+        const Pinyin *p = pinyin[i + pinyin_begin];
+        int sheng = modes[i] / 3;
+        int yun = modes[i] % 3;
+
+        stmt->bindInt (DB_PARAM_SHENG (i, 0), p->pinyin_id[0].sheng);
+        if (sheng & 1)
+            stmt->bindInt (DB_PARAM_SHENG (i, 1), p->pinyin_id[1].sheng);
+        if (sheng & 2)
+            stmt->bindInt (DB_PARAM_SHENG (i, 2), p->pinyin_id[2].sheng);
+
+        if (yun > 0)
+            stmt->bindInt (DB_PARAM_YUN (i, 0), p->pinyin_id[0].yun);
+        if (yun > 1)
+            stmt->bindInt (DB_PARAM_YUN (i, 1), p->pinyin_id[1].yun);
+    }
+
+    bindRanges (stmt, db, shape, pinyin, pinyin_begin, max_len);
+
+    return stmt;
+}
+
+std::string
+Database::keyedWhere (const std::string & key, size_t len)
+{
+    size_t ranges;
+    size_t prefix = key_prefix (key, len, &ranges);
+    String where;
+
+    where << "(";
+    for (size_t r = 0; r < ranges; r++) {
+        if (r > 0)
+            where << " OR ";
+        where.appendPrintf ("k BETWEEN ?%d AND ?%d",
+                            (int) DB_PARAM_RANGE (len, r, 0), (int) DB_PARAM_RANGE (len, r, 1));
+    }
+    where << ")";
+
+    for (size_t i = prefix; i < len; i++) {
+        char s[24], y[24];
+
+        if (i < DB_KEY_SYLLABLES) {
+            g_snprintf (s, sizeof (s), "((k>>%d)&63)", (int) DB_KEY_SHIFT_SHENG (i));
+            g_snprintf (y, sizeof (y), "((k>>%d)&63)", (int) DB_KEY_SHIFT_YUN (i));
+        }
         else {
-            conditions.appendPrintf (0, conditions.size (),
-                                       "s%d=%d", i, p->pinyin_id[0].sheng);
+            g_snprintf (s, sizeof (s), "s%d", (int) i);
+            g_snprintf (y, sizeof (y), "y%d", (int) i);
         }
+        where << " AND ";
+        append_condition (where, s, y, i, key[i]);
+    }
 
-        if (p->pinyin_id[0].yun != PINYIN_ID_ZERO) {
-            if (pinyin_option_check_yun (option, p->pinyin_id[0].yun, p->pinyin_id[1].yun)) {
-                if (G_LIKELY (i < DB_INDEX_SIZE)) {
-                    conditions.double_ ();
-                    conditions.appendPrintf (0, conditions.size ()  >> 1,
-                                               " AND y%d=%d", i, p->pinyin_id[0].yun);
-                    conditions.appendPrintf (conditions.size () >> 1, conditions.size (),
-                                               " and y%d=%d", i, p->pinyin_id[1].yun);
+    return where;
+}
+
+/* Returns the lengths of which the phrase table of the database db has the
+ * initials index, bit len - 1 for length len. */
+unsigned int
+Database::initialsIndexes (const char *db)
+{
+    unsigned int lengths = 0;
+    sqlite3_stmt *stmt = NULL;
+
+    m_sql.printf ("SELECT name FROM %s.sqlite_master WHERE type='index'", db);
+    if (sqlite3_prepare_v2 (m_db, m_sql, -1, &stmt, NULL) == SQLITE_OK) {
+        while (sqlite3_step (stmt) == SQLITE_ROW) {
+            const char *name = (const char *) sqlite3_column_text (stmt, 0);
+            int i;
+            char initials;
+            if (name != NULL &&
+                std::sscanf (name, "index_%d_%c", &i, &initials) == 2 &&
+                initials == 's' && i >= 0 && i < MAX_PHRASE_LEN)
+                lengths |= 1U << i;
+        }
+    }
+    sqlite3_finalize (stmt);
+    return lengths;
+}
+
+/* Checks whether the phrases of length len of a query seek the initials
+ * index: the query is abbreviated and the index exists. */
+bool
+Database::useInitials (char db, const std::string & key, size_t len) const
+{
+    unsigned int lengths = db == DB_QUERY_USER ? m_user_initials : m_main_initials;
+    return (lengths & (1U << (len - 1))) && is_abbreviated (key, len);
+}
+
+std::string
+Database::initialsWhere (const std::string & key, size_t len)
+{
+    size_t ranges;
+    size_t prefix = initials_prefix (key, len, &ranges);
+    String where;
+
+    /* the unary + keeps sqlite from seeking more combinations of shengs
+     * than the prefix has */
+    for (size_t i = 0; i < len; i++) {
+        char s[8], y[8];
+
+        g_snprintf (s, sizeof (s), i < prefix ? "s%d" : "+s%d", (int) i);
+        g_snprintf (y, sizeof (y), "+y%d", (int) i);
+        if (i > 0)
+            where << " AND ";
+        append_condition (where, s, y, i, key[i]);
+    }
+
+    return where;
+}
+
+void
+Database::bindRanges (SQLStmtPtr         & stmt,
+                      char                 db,
+                      const std::string  & key,
+                      const PinyinArray  & pinyin,
+                      size_t               pinyin_begin,
+                      size_t               max_len)
+{
+    bool keyed = db == DB_QUERY_MAIN && m_main_keyed;
+
+    for (size_t len = 1; len <= max_len; len++) {
+        if (!SHAPE_HAS_LEN (key[len - 1]))
+            continue;
+
+        if (!keyed || useInitials (db, key, len))
+            continue;
+
+        size_t ranges;
+        size_t prefix = key_prefix (key, len, &ranges);
+
+        /* enumerate the acceptable sheng and yun ids of the prefix, the
+         * last pinyin varies fastest */
+        for (size_t r = 0; r < ranges; r++) {
+            gint64 lo = 0;
+            int bits = DB_KEY_SHIFT_YUN (prefix - 1);
+            size_t n = r;
+
+            for (size_t i = prefix; i-- > 0;) {
+                const Pinyin *p = pinyin[i + pinyin_begin];
+                int sheng = SHAPE_SHENG (key[i]);
+                int yun = SHAPE_YUN (key[i]);
+                int shengs[3] = { p->pinyin_id[0].sheng, 0, 0 };
+                int yuns[2] = { p->pinyin_id[0].yun, p->pinyin_id[1].yun };
+                size_t nsheng = 1;
+                size_t nyun = yun == 2 ? 2 : 1;
+
+                if (sheng & 1)
+                    shengs[nsheng++] = p->pinyin_id[1].sheng;
+                if (sheng & 2)
+                    shengs[nsheng++] = p->pinyin_id[2].sheng;
+
+                lo |= (gint64) shengs[n % nsheng] << DB_KEY_SHIFT_SHENG (i);
+                n /= nsheng;
+                if (yun == 0) {
+                    bits = DB_KEY_SHIFT_SHENG (i);
                 }
                 else {
-                    conditions.appendPrintf (0, conditions.size (),
-                                               " AND y%d IN (%d,%d)", i, p->pinyin_id[0].yun, p->pinyin_id[1].yun);
+                    lo |= (gint64) yuns[n % nyun] << DB_KEY_SHIFT_YUN (i);
+                    n /= nyun;
                 }
             }
-            else {
-                conditions.appendPrintf (0, conditions.size (),
-                                           " AND y%d=%d", i, p->pinyin_id[0].yun);
-            }
+
+            stmt->bindInt64 (DB_PARAM_RANGE (len, r, 0), lo);
+            stmt->bindInt64 (DB_PARAM_RANGE (len, r, 1), lo | (((gint64) 1 << bits) - 1));
         }
     }
+}
 
+SQLStmtPtr
+Database::buildQuery (char db, const std::string & key)
+{
+    /* prepare sql: every pinyin expands to a small set of acceptable ids,
+     * so the where clause stays linear in the number of pinyins and
+     * sqlite can walk the index once with IN lists. The conditions of a
+     * shorter phrase are a prefix of the conditions of a longer one. */
+    size_t ends[MAX_PHRASE_LEN];
+    unsigned int lengths = 0;
+    bool keyed = db == DB_QUERY_MAIN && m_main_keyed;
 
     m_buffer.clear ();
-    for (size_t i = 0; i < conditions.size (); i++) {
-        if (G_UNLIKELY (i == 0))
-            m_buffer << "  (" << conditions[i] << ")\n";
-        else
-            m_buffer << "  OR (" << conditions[i] << ")\n";
+    for (size_t i = 0; i < key.size (); i++) {
+        char s[8], y[8];
+
+        if (G_LIKELY (i > 0))
+            m_buffer << " AND ";
+
+        g_snprintf (s, sizeof (s), "s%d", (int) i);
+        g_snprintf (y, sizeof (y), "y%d", (int) i);
+        append_condition (m_buffer, s, y, i, key[i]);
+        ends[i] = m_buffer.size ();
     }
 
+    /* One arm per phrase length, padded with zero ids to the same number
+     * of columns, so a single statement returns every length. It is not
+     * a single walk: every arm seeks its own table, so the cost still
+     * grows with the number of lengths. The arms are concatenated longest
+     * first, and each is sorted by itself, as an ORDER BY of the compound
+     * would sort every arm before the first row. An arm of exact
+     * syllables on the main database reads its rows in order from the
+     * first index of create_index.sql, and stops at the LIMIT. The main
+     * and the user database have their own statements, sorted in the
+     * same order, which QueryResult merges. */
     m_sql.clear ();
-    int id = pinyin_len - 1;
-    m_sql << "SELECT * FROM ("
-                "SELECT 0 AS user_freq, * FROM main.py_phrase_" << id << " WHERE " << m_buffer << " UNION ALL "
-                "SELECT * FROM userdb.py_phrase_" << id << " WHERE " << m_buffer << ") "
-                    "GROUP BY phrase ORDER BY user_freq DESC, freq DESC";
-    if (m > 0)
-        m_sql << " LIMIT " << m;
+    for (size_t len = key.size (); len > 0; len--) {
+        int id = len - 1;
+
+        if (!SHAPE_HAS_LEN (key[id]))
+            continue;
+
+        bool initials = useInitials (db, key, len);
+        std::string where;
+        if (initials)
+            where = initialsWhere (key, len);
+        else if (keyed)
+            where = keyedWhere (key, len);
+        else
+            where.assign (m_buffer, 0, ends[id]);
+
+        if (lengths != 0)
+            m_sql << " UNION ALL ";
+        lengths |= 1 << id;
+        m_sql << "SELECT * FROM (SELECT " << (db == DB_QUERY_USER ? "user_freq" : "0")
+              << ",phrase,freq," << id + 1;
+        for (size_t i = 0; i < key.size (); i++) {
+            if (i >= len)
+                m_sql << ",0,0";
+            else if (keyed && i < DB_KEY_SYLLABLES)
+                m_sql << ",((k>>" << DB_KEY_SHIFT_SHENG (i) << ")&63)"
+                         ",((k>>" << DB_KEY_SHIFT_YUN (i) << ")&63)";
+            else
+                m_sql << ",s" << i << ",y" << i;
+        }
+        m_sql << " FROM " << (db == DB_QUERY_USER ? "userdb" : "main")
+              << ".py_phrase_" << id;
+        /* sqlite would rather read the covering index, which only seeks
+         * the first sheng */
+        if (initials)
+            m_sql << " INDEXED BY index_" << id << "_s";
+        m_sql << " WHERE " << where;
+
+        /* keyset continuation: only the rows after the last row of the
+         * previous page, in the order below */
+        const char *user_freq = db == DB_QUERY_USER ? "user_freq" : "0";
+        m_sql.appendPrintf (" AND (?%d>%d OR (?%d=%d AND (%s<?%d OR (%s=?%d AND "
+                            "(freq<?%d OR (freq=?%d AND phrase>?%d))))))",
+                            DB_PARAM_AFTER_LEN, id + 1, DB_PARAM_AFTER_LEN, id + 1,
+                            user_freq, DB_PARAM_AFTER_USER_FREQ,
+                            user_freq, DB_PARAM_AFTER_USER_FREQ,
+                            DB_PARAM_AFTER_FREQ, DB_PARAM_AFTER_FREQ,
+                            DB_PARAM_AFTER_PHRASE);
+
+        /* the constant user_freq of the main database is not a term, so
+         * the order can be read from the index */
+        m_sql << " ORDER BY " << (db == DB_QUERY_USER ? "user_freq DESC," : "")
+              << "freq DESC,phrase LIMIT ?" << DB_PARAM_LIMIT << ")";
+    }
+    m_sql << " LIMIT ?" << DB_PARAM_LIMIT;
 #if 0
     g_debug ("sql =\n%s", m_sql.c_str ());
 #endif
@@ -655,43 +2130,107 @@ Database::query (const PinyinArray &pinyin,
     if (!stmt->prepare (m_sql)) {
         stmt.reset ();
     }
+    else {
+        stmt->setLengths (lengths);
+    }
 
     return stmt;
 }
 
-inline void
-Database::phraseWhereSql (const Phrase & p, String & sql)
+SQLStmtPtr
+Database::writeStmt (WriteStmt kind, const Phrase & phrase)
 {
-    sql << " WHERE";
-    sql << " s0=" << p.pinyin_id[0].sheng
-        << " AND y0=" << p.pinyin_id[0].yun;
-    for (size_t i = 1; i < p.len; i++) {
-        sql << " AND s" << i << '=' << p.pinyin_id[i].sheng
-            << " AND y" << i << '=' << p.pinyin_id[i].yun;
+    SQLStmtPtr & stmt = m_write_stmts[kind][phrase.len - 1];
+
+    if (G_UNLIKELY (stmt.get () == NULL)) {
+        m_sql.clear ();
+        switch (kind) {
+        case WRITE_INSERT:
+            m_sql.appendPrintf ("INSERT OR IGNORE INTO userdb.py_phrase_%d "
+                                "(user_freq,phrase,freq,atime", (int) phrase.len - 1);
+            for (size_t i = 0; i < phrase.len; i++)
+                m_sql.appendPrintf (",s%d,y%d", (int) i, (int) i);
+            m_sql.appendPrintf (") VALUES(0,?%d,?%d,?%d",
+                                DB_WRITE_PARAM_PHRASE, DB_WRITE_PARAM_VALUE, DB_WRITE_PARAM_TIME);
+            for (size_t i = 0; i < phrase.len; i++)
+                m_sql.appendPrintf (",?%d,?%d",
+                                    (int) DB_WRITE_PARAM_SHENG (i), (int) DB_WRITE_PARAM_YUN (i));
+            m_sql << ")";
+            break;
+        case WRITE_UPDATE:
+            m_sql.appendPrintf ("UPDATE userdb.py_phrase_%d SET user_freq=user_freq+?%d,atime=max(coalesce(atime,0),?%d)",
+                                (int) phrase.len - 1, DB_WRITE_PARAM_VALUE, DB_WRITE_PARAM_TIME);
+            break;
+        case WRITE_DELETE:
+            m_sql.appendPrintf ("DELETE FROM userdb.py_phrase_%d", (int) phrase.len - 1);
+            break;
+        case WRITE_SELECT:
+            m_sql.appendPrintf ("SELECT user_freq FROM userdb.py_phrase_%d", (int) phrase.len - 1);
+            break;
+        default:
+            g_assert_not_reached ();
+        }
+
+        if (kind != WRITE_INSERT) {
+            m_sql.appendPrintf (" WHERE phrase=?%d", DB_WRITE_PARAM_PHRASE);
+            for (size_t i = 0; i < phrase.len; i++)
+                m_sql.appendPrintf (" AND s%d=?%d AND y%d=?%d",
+                                    (int) i, (int) DB_WRITE_PARAM_SHENG (i),
+                                    (int) i, (int) DB_WRITE_PARAM_YUN (i));
+        }
+
+        stmt.reset (new SQLStmt (m_db));
+        if (!stmt->prepare (m_sql)) {
+            stmt.reset ();
+            return stmt;
+        }
     }
-    sql << " AND phrase=\"" << p.phrase << "\"";
 
+    stmt->reset ();
+    stmt->bindStaticText (DB_WRITE_PARAM_PHRASE, phrase.phrase);
+    for (size_t i = 0; i < phrase.len; i++) {
+        stmt->bindInt (DB_WRITE_PARAM_SHENG (i), phrase.pinyin_id[i].sheng);
+        stmt->bindInt (DB_WRITE_PARAM_YUN (i), phrase.pinyin_id[i].yun);
+    }
+    return stmt;
 }
 
-inline void
-Database::phraseSql (const Phrase & p, String & sql)
+/* The key of a phrase in the pending updates. */
+static std::string
+pending_key (const Phrase & phrase)
 {
-    sql << "INSERT OR IGNORE INTO userdb.py_phrase_" << p.len - 1
-        << " VALUES(" << 0                  /* user_freq */
-        << ",\"" << p.phrase << '"'         /* phrase */
-        << ','   << p.freq;                 /* freq */
+    std::string key (phrase.phrase);
+    key.append (1, '\0');
+    key.append ((const char *) phrase.pinyin_id, phrase.len * sizeof (phrase.pinyin_id[0]));
+    return key;
+}
 
-    for (size_t i = 0; i < p.len; i++) {
-        sql << ',' << p.pinyin_id[i].sheng << ',' << p.pinyin_id[i].yun;
+void
+Database::pend (const Phrase & phrase)
+{
+    std::pair<PendingMap::iterator, bool> ret =
+        m_pending.insert (std::make_pair (pending_key (phrase), Pending ()));
+    Pending & pending = ret.first->second;
+
+    if (ret.second) {
+        /* queries see the phrase with the user_freq it will have */
+        pending.phrase = phrase;
+        pending.phrase.user_freq = 0;
+        pending.count = 0;
+
+        SQLStmtPtr stmt = writeStmt (WRITE_SELECT, pending.phrase);
+        if (stmt.get () != NULL) {
+            if (stmt->step ())
+                pending.phrase.user_freq = stmt->columnInt (0);
+            stmt->reset ();
+        }
     }
+    pending.phrase.user_freq ++;
+    pending.count ++;
+    m_hot.update (pending.phrase);
 
-    sql << ");\n";
-
-    sql << "UPDATE userdb.py_phrase_" << p.len - 1
-        << " SET user_freq=user_freq+1";
-
-    phraseWhereSql (p, sql);
-    sql << ";\n";
+    filterInsert (phrase);
+    invalidateResults (phrase);
 }
 
 void
@@ -699,37 +2238,617 @@ Database::commit (const PhraseArray  &phrases)
 {
     Phrase phrase = {""};
 
-    m_sql = "BEGIN TRANSACTION;\n";
     for (size_t i = 0; i < phrases.size (); i++) {
         phrase += phrases[i];
-        phraseSql (phrases[i], m_sql);
+        pend (phrases[i]);
     }
     if (phrases.size () > 1)
-        phraseSql (phrase, m_sql);
-    m_sql << "COMMIT;\n";
+        pend (phrase);
 
-    executeSQL (m_sql);
+    m_pending_commits ++;
+    if (m_pending.size () >= DB_PENDING_SIZE ||
+        m_pending_commits >= DB_PENDING_COMMITS) {
+        flush ();
+    }
+    else if (m_flush_id == 0) {
+        m_flush_id = g_timeout_add_seconds (DB_FLUSH_TIMEOUT,
+                                            Database::flushCallback,
+                                            static_cast<void *> (this));
+    }
+}
+
+void
+Database::flush (void)
+{
+    m_pending_commits = 0;
+    if (m_pending.empty ())
+        return;
+
+    gint64 now = std::time (NULL);
+
+    executeSQL ("BEGIN TRANSACTION;");
+    for (PendingMap::const_iterator it = m_pending.begin (); it != m_pending.end (); ++it) {
+        const Pending & pending = it->second;
+        writePhrase (pending.phrase, pending.count, now);
+    }
+    executeSQL ("COMMIT;");
+
+    /* the cached results hold the pending phrases with the same user_freq
+     * as they have in the database now, so they are still valid */
+    m_pending.clear ();
     modified ();
+
+    if (m_user_limit != 0 && m_user_rows > m_user_limit && m_compact_id == 0)
+        m_compact_id = g_idle_add (Database::compactCallback, static_cast<void *> (this));
+}
+
+gboolean
+Database::flushCallback (void * data)
+{
+    Database *self = static_cast<Database*> (data);
+
+    self->m_flush_id = 0;
+    self->flush ();
+    self->suspendResults ();
+    return false;
 }
 
 void
 Database::remove (const Phrase & phrase)
 {
-    m_sql = "BEGIN TRANSACTION;\n";
-    m_sql << "DELETE FROM userdb.py_phrase_" << phrase.len - 1;
-    phraseWhereSql (phrase, m_sql);
-    m_sql << ";\n";
-    m_sql << "COMMIT;\n";
+    m_pending.erase (pending_key (phrase));
+    m_hot.erase (phrase);
+
+    SQLStmtPtr stmt = writeStmt (WRITE_DELETE, phrase);
+    if (stmt.get () != NULL) {
+        stmt->step ();
+        stmt->reset ();
+        m_user_rows -= MIN (m_user_rows, (size_t) sqlite3_changes (m_db));
+    }
+    invalidateResults (phrase);
+    modified ();
+}
+
+void
+Database::setUserLimit (unsigned int rows)
+{
+    m_user_limit = rows;
+    if (rows == 0)
+        return;
 
-    executeSQL (m_sql);
+    /* the rows are counted by the writes from now on */
+    m_sql = "SELECT 0";
+    for (size_t i = 0; i < MAX_PHRASE_LEN; i++)
+        m_sql.appendPrintf ("+(SELECT count(*) FROM userdb.py_phrase_%d)", (int) i);
+
+    SQLStmt stmt (m_db);
+    if (stmt.prepare (m_sql) && stmt.step ())
+        m_user_rows = stmt.columnInt (0);
+
+    if (m_user_rows > m_user_limit && m_compact_id == 0)
+        m_compact_id = g_idle_add (Database::compactCallback, static_cast<void *> (this));
+}
+
+bool
+Database::compactStep (void)
+{
+    if (m_compact_threshold < 0 && !m_compact_scanning) {
+        size_t low = (size_t) m_user_limit * DB_COMPACT_LOW / 100;
+        if (m_user_limit == 0 || m_user_rows <= m_user_limit)
+            return false;
+
+        /* the scores are read from the rows, so the pending updates are
+         * written first; a later update gives its phrase a new atime,
+         * which keeps it above the threshold */
+        flush ();
+
+        m_compact_now = std::time (NULL);
+        m_compact_left = m_user_rows - low;
+        m_compact_scores.clear ();
+        m_compact_scanning = true;
+        m_compact_table = MAX_PHRASE_LEN - 1;
+        m_compact_rowid = 0;
+
+        /* the hot phrases are loaded again after compaction */
+        m_hot.clear ();
+        return true;
+    }
+
+    if (m_compact_scanning) {
+        /* count the scores of the next rows of the table */
+        size_t rows = 0;
+        m_sql.printf ("SELECT rowid," DB_DECAY_SCORE ("?1") " FROM userdb.py_phrase_%d "
+                      "WHERE rowid>?2 ORDER BY rowid LIMIT ?3", m_compact_table);
+        SQLStmt stmt (m_db);
+        if (stmt.prepare (m_sql) &&
+            stmt.bindInt64 (1, m_compact_now) &&
+            stmt.bindInt64 (2, m_compact_rowid) &&
+            stmt.bindInt64 (3, DB_COMPACT_SCAN)) {
+            while (stmt.step ()) {
+                m_compact_rowid = stmt.columnInt64 (0);
+                m_compact_scores[stmt.columnInt64 (1)] ++;
+                rows ++;
+            }
+        }
+        if (rows == DB_COMPACT_SCAN)
+            return true;
+        if (m_compact_table > 0) {
+            m_compact_table --;
+            m_compact_rowid = 0;
+            return true;
+        }
+
+        /* the score of the last phrase to delete, the lowest scores first */
+        size_t count = 0;
+        std::map<gint64, size_t>::const_iterator it;
+        for (it = m_compact_scores.begin (); it != m_compact_scores.end (); ++it) {
+            m_compact_threshold = it->first;
+            count += it->second;
+            if (count >= m_compact_left)
+                break;
+        }
+        m_compact_scores.clear ();
+        m_compact_scanning = false;
+        m_compact_table = MAX_PHRASE_LEN - 1;
+        m_compact_rowid = 0;
+        m_compact_ties = false;
+        if (count == 0) {
+            m_compact_threshold = -1;
+            loadHot ();
+            return false;
+        }
+        return true;
+    }
+
+    /* the phrases below the threshold first, then the ones at it until
+     * enough are deleted, the longest phrases first */
+    size_t batch = MIN (m_compact_left, (size_t) DB_COMPACT_BATCH);
+    m_sql.printf ("SELECT rowid,phrase");
+    for (int i = 0; i <= m_compact_table; i++)
+        m_sql.appendPrintf (",s%d,y%d", i, i);
+    m_sql.appendPrintf (" FROM userdb.py_phrase_%d WHERE rowid>?4 AND " DB_DECAY_SCORE ("?1") "%s?2 "
+                        "ORDER BY rowid LIMIT ?3",
+                        m_compact_table, m_compact_ties ? "=" : "<");
+
+    /* the rows are read before they are deleted, so only the cached
+     * results which have them are dropped */
+    std::vector<gint64> rowids;
+    PhraseArray phrases;
+    SQLStmt select (m_db);
+    if (select.prepare (m_sql) &&
+        select.bindInt64 (1, m_compact_now) &&
+        select.bindInt64 (2, m_compact_threshold) &&
+        select.bindInt64 (3, batch) &&
+        select.bindInt64 (4, m_compact_rowid)) {
+        Phrase phrase = {""};
+        phrase.len = m_compact_table + 1;
+        while (select.step ()) {
+            rowids.push_back (select.columnInt64 (0));
+            m_compact_rowid = rowids.back ();
+            const char *text = select.columnText (1);
+            g_strlcpy (phrase.phrase, text != NULL ? text : "", sizeof (phrase.phrase));
+            for (size_t i = 0; i < phrase.len; i++) {
+                phrase.pinyin_id[i].sheng = select.columnInt (2 + i * 2);
+                phrase.pinyin_id[i].yun = select.columnInt (3 + i * 2);
+            }
+            phrases.push_back (phrase);
+        }
+    }
+
+    size_t deleted = 0;
+    m_sql.printf ("DELETE FROM userdb.py_phrase_%d WHERE rowid=?1", m_compact_table);
+    SQLStmt stmt (m_db);
+    if (!rowids.empty () && stmt.prepare (m_sql)) {
+        executeSQL ("BEGIN TRANSACTION;");
+        for (size_t i = 0; i < rowids.size (); i++) {
+            stmt.bindInt64 (1, rowids[i]);
+            stmt.step ();
+            stmt.reset ();
+            deleted += sqlite3_changes (m_db);
+        }
+        executeSQL ("COMMIT;");
+    }
+
+    if (deleted > 0) {
+        m_user_rows -= MIN (m_user_rows, deleted);
+        m_compact_left -= MIN (m_compact_left, deleted);
+        m_user_generation ++;
+        for (size_t i = 0; i < phrases.size (); i++)
+            invalidateResults (phrases[i]);
+        modified ();
+    }
+
+    /* the rest of the table has no such phrase */
+    if (rowids.size () < batch) {
+        m_compact_rowid = 0;
+        if (m_compact_table > 0) {
+            m_compact_table --;
+        }
+        else if (!m_compact_ties) {
+            m_compact_table = MAX_PHRASE_LEN - 1;
+            m_compact_ties = true;
+        }
+        else {
+            m_compact_left = 0;
+        }
+    }
+
+    if (m_compact_left == 0) {
+        m_compact_threshold = -1;
+        loadHot ();
+        return false;
+    }
+    return true;
+}
+
+void
+Database::compact (void)
+{
+    while (compactStep ());
+    if (m_compact_id != 0) {
+        g_source_remove (m_compact_id);
+        m_compact_id = 0;
+    }
+}
+
+gboolean
+Database::compactCallback (void * data)
+{
+    Database *self = static_cast<Database*> (data);
+
+    if (self->compactStep ())
+        return true;
+
+    self->m_compact_id = 0;
+    return false;
+}
+
+void
+Database::setHotSize (unsigned int size)
+{
+    m_hot_size = size;
+    /* not while the set is dropped for compaction */
+    if (m_compact_threshold < 0)
+        loadHot ();
+    flushResults ();
+}
+
+void
+Database::loadHot (void)
+{
+    m_hot.reset (m_hot_size);
+    if (m_hot_size == 0)
+        return;
+
+    m_sql.clear ();
+    for (size_t i = 0; i < MAX_PHRASE_LEN; i++) {
+        if (i > 0)
+            m_sql << " UNION ALL ";
+        m_sql.appendPrintf ("SELECT user_freq,phrase,freq,%d", (int) i + 1);
+        for (size_t j = 0; j < MAX_PHRASE_LEN; j++) {
+            if (j <= i)
+                m_sql.appendPrintf (",s%d,y%d", (int) j, (int) j);
+            else
+                m_sql << ",0,0";
+        }
+        m_sql.appendPrintf (" FROM userdb.py_phrase_%d", (int) i);
+    }
+    m_sql << " ORDER BY " << DB_COLUMN_USER_FREQ + 1 << " DESC LIMIT ?1";
+
+    SQLStmt stmt (m_db);
+    if (!stmt.prepare (m_sql) || !stmt.bindInt (1, m_hot_size + 1)) {
+        m_hot.clear ();
+        return;
+    }
+
+    /* one more phrase tells whether there are phrases which are not hot */
+    for (size_t n = 0; stmt.step (); n++) {
+        Phrase phrase;
+        phrase.user_freq = stmt.columnInt (DB_COLUMN_USER_FREQ);
+        if (n == m_hot_size) {
+            m_hot.truncate (phrase.user_freq);
+            break;
+        }
+
+        g_strlcpy (phrase.phrase, stmt.columnText (DB_COLUMN_PHRASE), sizeof (phrase.phrase));
+        phrase.freq = stmt.columnInt (DB_COLUMN_FREQ);
+        phrase.len = stmt.columnInt (DB_COLUMN_LEN);
+        for (size_t i = 0, column = DB_COLUMN_S0; i < phrase.len; i++) {
+            phrase.pinyin_id[i].sheng = stmt.columnInt (column++);
+            phrase.pinyin_id[i].yun = stmt.columnInt (column++);
+        }
+        m_hot.update (phrase);
+    }
+
+    for (PendingMap::const_iterator it = m_pending.begin (); it != m_pending.end (); ++it)
+        m_hot.update (it->second.phrase);
+}
+
+void
+Database::mainPhrases (PhraseArray & phrases)
+{
+    for (size_t i = 0; i < MAX_PHRASE_LEN; i++) {
+        /* the bare columns are taken from the row of max (freq) */
+        m_sql = "SELECT phrase,max(freq)";
+        for (size_t j = 0; j <= i; j++)
+            m_sql.appendPrintf (",s%d,y%d", (int) j, (int) j);
+        m_sql.appendPrintf (" FROM main.py_phrase_%d GROUP BY phrase", (int) i);
+
+        SQLStmt stmt (m_db);
+        if (!stmt.prepare (m_sql))
+            continue;
+        while (stmt.step ()) {
+            Phrase phrase;
+            g_strlcpy (phrase.phrase, stmt.columnText (0), sizeof (phrase.phrase));
+            phrase.freq = stmt.columnInt (1);
+            phrase.user_freq = 0;
+            phrase.len = i + 1;
+            for (size_t j = 0, column = 2; j < phrase.len; j++) {
+                phrase.pinyin_id[j].sheng = stmt.columnInt (column++);
+                phrase.pinyin_id[j].yun = stmt.columnInt (column++);
+            }
+            phrases.push_back (phrase);
+        }
+    }
+}
+
+void
+Database::allPhrases (bool user, PhraseArray & phrases)
+{
+    /* the pending updates are rows of the user database after it */
+    if (user)
+        flush ();
+
+    for (size_t i = 0; i < MAX_PHRASE_LEN; i++) {
+        m_sql = user ? "SELECT user_freq" : "SELECT 0";
+        m_sql.appendPrintf (",phrase,freq,%d", (int) i + 1);
+        for (size_t j = 0; j <= i; j++)
+            m_sql.appendPrintf (",s%d,y%d", (int) j, (int) j);
+        m_sql.appendPrintf (" FROM %s.py_phrase_%d", user ? "userdb" : "main", (int) i);
+
+        SQLStmt stmt (m_db);
+        if (!stmt.prepare (m_sql))
+            continue;
+        while (stmt.step ()) {
+            Phrase phrase;
+            phrase.user_freq = stmt.columnInt (DB_COLUMN_USER_FREQ);
+            g_strlcpy (phrase.phrase, stmt.columnText (DB_COLUMN_PHRASE), sizeof (phrase.phrase));
+            phrase.freq = stmt.columnInt (DB_COLUMN_FREQ);
+            phrase.len = stmt.columnInt (DB_COLUMN_LEN);
+            for (size_t j = 0, column = DB_COLUMN_S0; j < phrase.len; j++) {
+                phrase.pinyin_id[j].sheng = stmt.columnInt (column++);
+                phrase.pinyin_id[j].yun = stmt.columnInt (column++);
+            }
+            phrases.push_back (phrase);
+        }
+    }
+}
+
+void
+Database::train (const PhraseArray & phrases)
+{
+    if (phrases.empty ())
+        return;
+
+    /* the pending phrases would keep the user_freq from before */
+    flush ();
+
+    gint64 now = std::time (NULL);
+    for (size_t i = 0; i < phrases.size (); i++) {
+        const Phrase & phrase = phrases[i];
+
+        if (i % DB_BULK_BATCH == 0) {
+            if (i > 0)
+                executeSQL ("COMMIT;");
+            executeSQL ("BEGIN TRANSACTION;");
+        }
+        writePhrase (phrase, phrase.user_freq, now);
+        filterInsert (phrase);
+    }
+    executeSQL ("COMMIT;");
+    bulkWritten ();
+}
+
+/* The interchange format of the user phrases is UTF-8 text. The first line
+ * is DB_EXPORT_HEADER, and every other line is a phrase, with tabs between
+ * the fields:
+ *
+ *   phrase user_freq freq atime s0 y0 s1 y1 ...
+ *
+ * The length of the phrase is the number of the pinyin ids. Empty lines
+ * and lines starting with '#' are skipped. */
+#define DB_EXPORT_HEADER    "# pyzy user phrases 1.0"
+#define DB_EXPORT_LINE_SIZE (PHRASE_LEN_IN_BYTE + 64 + MAX_PHRASE_LEN * 8)
+
+bool
+Database::exportUserPhrases (const char *path)
+{
+    flush ();
+
+    FILE *file = g_fopen (path, "w");
+    if (file == NULL) {
+        g_warning ("Can not open %s: %s", path, g_strerror (errno));
+        return false;
+    }
+    fputs (DB_EXPORT_HEADER "\n", file);
+
+    for (size_t i = 0; i < MAX_PHRASE_LEN; i++) {
+        m_sql = "SELECT user_freq,phrase,freq,atime";
+        for (size_t j = 0; j <= i; j++)
+            m_sql.appendPrintf (",s%d,y%d", (int) j, (int) j);
+        m_sql.appendPrintf (" FROM userdb.py_phrase_%d", (int) i);
+
+        SQLStmt stmt (m_db);
+        if (!stmt.prepare (m_sql))
+            continue;
+        while (stmt.step ()) {
+            fprintf (file, "%s\t%d\t%d\t%" G_GINT64_FORMAT,
+                     stmt.columnText (1), stmt.columnInt (0),
+                     stmt.columnInt (2), stmt.columnInt64 (3));
+            for (size_t j = 0, column = 4; j <= i; j++, column += 2)
+                fprintf (file, "\t%d\t%d", stmt.columnInt (column), stmt.columnInt (column + 1));
+            fputc ('\n', file);
+        }
+    }
+
+    bool retval = !ferror (file);
+    if (fclose (file) != 0)
+        retval = false;
+    if (!retval)
+        g_warning ("Can not write %s", path);
+    return retval;
+}
+
+/* Parses a line of the interchange format into the phrase and its atime. */
+static bool
+parse_export_line (char *line, Phrase & phrase, gint64 & atime)
+{
+    char *p = std::strchr (line, '\t');
+    if (p == NULL || p == line || (size_t) (p - line) >= sizeof (phrase.phrase))
+        return false;
+    std::memcpy (phrase.phrase, line, p - line);
+    phrase.phrase[p - line] = 0;
+
+    guint64 values[3 + MAX_PHRASE_LEN * 2];
+    size_t n = 0;
+    while (*p == '\t') {
+        char *end;
+        if (n == G_N_ELEMENTS (values))
+            return false;
+        values[n++] = g_ascii_strtoull (p + 1, &end, 10);
+        if (end == p + 1)
+            return false;
+        p = end;
+    }
+    if (*p != '\n' && *p != '\r' && *p != 0)
+        return false;
+    if (n < 5 || (n - 3) % 2 != 0)
+        return false;
+
+    phrase.user_freq = (unsigned int) MIN (values[0], (guint64) G_MAXINT);
+    phrase.freq = (unsigned int) MIN (values[1], (guint64) G_MAXINT);
+    atime = (gint64) MIN (values[2], (guint64) G_MAXINT64);
+    phrase.len = (n - 3) / 2;
+
+    /* every character of the phrase has its pinyin */
+    if (!g_utf8_validate (phrase.phrase, -1, NULL) ||
+        g_utf8_strlen (phrase.phrase, -1) != (glong) phrase.len)
+        return false;
+
+    for (size_t i = 0; i < phrase.len; i++) {
+        if (values[3 + i * 2] > PINYIN_ID_V || values[4 + i * 2] > PINYIN_ID_V)
+            return false;
+        phrase.pinyin_id[i].sheng = values[3 + i * 2];
+        phrase.pinyin_id[i].yun = values[4 + i * 2];
+    }
+    return true;
+}
+
+bool
+Database::importUserPhrases (const char *path)
+{
+    FILE *file = g_fopen (path, "r");
+    if (file == NULL) {
+        g_warning ("Can not open %s: %s", path, g_strerror (errno));
+        return false;
+    }
+
+    char line[DB_EXPORT_LINE_SIZE];
+    if (fgets (line, sizeof (line), file) == NULL ||
+        std::strncmp (line, DB_EXPORT_HEADER, sizeof (DB_EXPORT_HEADER) - 1) != 0) {
+        g_warning ("%s is not a pyzy user phrase file", path);
+        fclose (file);
+        return false;
+    }
+
+    /* the pending phrases would keep the user_freq from before */
+    flush ();
+
+    /* one line at a time, so the memory does not grow with the file */
+    size_t rows = 0, lineno = 1, bad = 0;
+    executeSQL ("BEGIN TRANSACTION;");
+    while (fgets (line, sizeof (line), file) != NULL) {
+        size_t len = std::strlen (line);
+        bool whole = len > 0 && line[len - 1] == '\n';
+        lineno ++;
+
+        /* skip the rest of a line which is too long */
+        if (!whole && !feof (file)) {
+            int c;
+            while ((c = fgetc (file)) != EOF && c != '\n');
+            bad ++;
+            continue;
+        }
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+            continue;
+
+        Phrase phrase;
+        gint64 atime;
+        if (!parse_export_line (line, phrase, atime)) {
+            if (bad ++ == 0)
+                g_warning ("%s:%" G_GSIZE_FORMAT ": bad phrase", path, lineno);
+            continue;
+        }
+
+        writePhrase (phrase, phrase.user_freq, atime);
+        filterInsert (phrase);
+        if (++ rows % DB_BULK_BATCH == 0) {
+            executeSQL ("COMMIT;");
+            executeSQL ("BEGIN TRANSACTION;");
+        }
+    }
+    executeSQL ("COMMIT;");
+
+    bool retval = !ferror (file);
+    fclose (file);
+    if (bad > 0)
+        g_warning ("%s: %" G_GSIZE_FORMAT " bad phrases skipped", path, bad);
+
+    bulkWritten ();
+    return retval;
+}
+
+/* Adds count to the user_freq of a phrase in the user database, and
+ * inserts it with the freq of the phrase if it is not there. */
+void
+Database::writePhrase (const Phrase & phrase, unsigned int count, gint64 atime)
+{
+    SQLStmtPtr stmt;
+
+    if ((stmt = writeStmt (WRITE_INSERT, phrase)).get () != NULL) {
+        stmt->bindInt (DB_WRITE_PARAM_VALUE, phrase.freq);
+        stmt->bindInt64 (DB_WRITE_PARAM_TIME, atime);
+        stmt->step ();
+        stmt->reset ();
+        m_user_rows += sqlite3_changes (m_db);
+    }
+    if ((stmt = writeStmt (WRITE_UPDATE, phrase)).get () != NULL) {
+        stmt->bindInt (DB_WRITE_PARAM_VALUE, count);
+        stmt->bindInt64 (DB_WRITE_PARAM_TIME, atime);
+        stmt->step ();
+        stmt->reset ();
+    }
+}
+
+/* Catches up with many phrases written at once. */
+void
+Database::bulkWritten (void)
+{
+    m_user_generation ++;
+    if (m_compact_threshold < 0)
+        loadHot ();
+    flushResults ();
     modified ();
+
+    if (m_user_limit != 0 && m_user_rows > m_user_limit && m_compact_id == 0)
+        m_compact_id = g_idle_add (Database::compactCallback, static_cast<void *> (this));
 }
 
 void
-Database::init (const std::string & user_data_dir)
+Database::init (const std::string & user_data_dir, unsigned int flags)
 {
     if (m_instance.get () == NULL) {
-        m_instance.reset (new Database (user_data_dir));
+        m_instance.reset (new Database (user_data_dir, flags));
     }
 }
 
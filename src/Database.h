@@ -22,7 +22,14 @@
 #ifndef __PYZY_DATABASE_H_
 #define __PYZY_DATABASE_H_
 
+#include <list>
+#include <map>
+
+#include "BloomFilter.h"
+#include "HotPhrases.h"
+#include "MappedDictionary.h"
 #include "PhraseArray.h"
+#include "PhraseSource.h"
 #include "String.h"
 #include "Types.h"
 #include "Util.h"
@@ -37,6 +44,12 @@ struct Phrase;
 class SQLStmt;
 typedef std::shared_ptr<SQLStmt> SQLStmtPtr;
 
+class QueryResult;
+typedef std::shared_ptr<QueryResult> QueryResultPtr;
+
+struct QueryStats;
+typedef std::shared_ptr<QueryStats> QueryStatsPtr;
+
 class Database;
 
 class Query {
@@ -53,28 +66,97 @@ private:
     size_t m_pinyin_begin;
     size_t m_pinyin_len;
     unsigned int m_option;
-    SQLStmtPtr m_stmt;
+    PhraseResultPtr m_result;
+    size_t m_pos;               /* phrases returned from m_result */
 };
 
-class Database {
+class Database : public PhraseSource {
 public:
     ~Database ();
 protected:
-    Database (const std::string & user_data_dir);
+    Database (const std::string & user_data_dir, unsigned int flags);
 
 public:
-    static void init (const std::string & data_dir);
+    static void init (const std::string & data_dir, unsigned int flags = 0);
 
-    SQLStmtPtr query (const PinyinArray   & pinyin,
-                      size_t                pinyin_begin,
-                      size_t                pinyin_len,
-                      int                   m,
-                      unsigned int          option);
+    PhraseResultPtr lookup (const PinyinArray   & pinyin,
+                            size_t                pinyin_begin,
+                            size_t                pinyin_len,
+                            unsigned int          option);
+    /* Returns the lengths of which phrases may match, bit n - 1 for
+     * length n. If main_phrases is given and the compiled dictionary is
+     * opened, the main phrases are looked up into it instead of
+     * main_stmt. */
+    unsigned int query (const PinyinArray   & pinyin,
+                        size_t                pinyin_begin,
+                        size_t                pinyin_len,
+                        int                   m,
+                        unsigned int          option,
+                        SQLStmtPtr          & main_stmt,
+                        SQLStmtPtr          & user_stmt,
+                        PhraseArray         * main_phrases = NULL);
     void commit (const PhraseArray  & phrases);
     void remove (const Phrase & phrase);
+    /* Writes the pending updates of the committed phrases. */
+    void flush (void);
+    /* Limits the phrases of the user database, 0 for no limit. The
+     * phrases over the limit are deleted in idle time, or by compact. */
+    void setUserLimit (unsigned int rows);
+    void compact (void);
+
+    /* The sum of the freq of every main phrase. */
+    gint64 freqTotal (void) const       { return m_freq_total; }
+    /* The compiled main dictionary, if it is opened. */
+    const MappedDictionary & dict (void) const  { return m_dict; }
+
+    /* Gets every phrase of the main database, with its most frequent
+     * pinyin only. */
+    void mainPhrases (PhraseArray & phrases);
+    /* Gets every row of the main or the user database. */
+    void allPhrases (bool user, PhraseArray & phrases);
+    /* Adds the user_freq of every phrase to it in the user database, in a
+     * few large transactions. */
+    void train (const PhraseArray & phrases);
+    /* Writes every user phrase to a text file, or merges the phrases of
+     * such a file into the user database. */
+    bool exportUserPhrases (const char *path);
+    bool importUserPhrases (const char *path);
+    /* Changes whenever rows of the user database are written or deleted
+     * other than by commit and remove, so a copy of them is read again. */
+    unsigned int userGeneration (void) const    { return m_user_generation; }
+
+    /* Sets how many user phrases of the highest user_freq are kept in
+     * memory, 0 to keep none. */
+    void setHotSize (unsigned int size);
+    /* A fetch of the candidates is a hit if it did not step any statement. */
+    void hotFetched (bool hit)              { if (hit) m_hot_hits ++; else m_hot_misses ++; }
+    unsigned long hotHits (void) const      { return m_hot_hits; }
+    unsigned long hotMisses (void) const    { return m_hot_misses; }
 
-    void conditionsDouble (void);
-    void conditionsTriple (void);
+    /* Records what the query statements cost, by their shape, while it is
+     * enabled. Enabling it drops the earlier records. */
+    void setQueryStats (bool enable);
+    std::string queryStatsReport (void);
+
+    unsigned long stmtCacheHits (void) const   { return m_stmt_cache_hits; }
+    unsigned long stmtCacheMisses (void) const { return m_stmt_cache_misses; }
+    /* Drops every cached query result. */
+    void flushResults (void);
+    unsigned long resultCacheHits (void) const   { return m_result_cache_hits; }
+    unsigned long resultCacheMisses (void) const { return m_result_cache_misses; }
+
+    /* Statistics of the phrase filter. The measured false positive rate
+     * is missed / (checked - skipped). */
+    struct FilterStats {
+        unsigned long checked;  /* phrase lengths tested with the filter */
+        unsigned long skipped;  /* lengths skipped without a query */
+        unsigned long missed;   /* lengths which passed but had no rows */
+        size_t keys;            /* keys in the filter */
+        size_t bytes;           /* memory used by the filter */
+        double fp_rate;         /* expected false positive rate */
+    };
+    FilterStats filterStats (void) const;
+    void filterMissed (unsigned int n)  { m_filter_missed += n; }
 
     static void finalize (void);
     static Database & instance (void)
@@ -82,19 +164,86 @@ public:
         if (m_instance.get () == NULL) {
             g_error ("Error: Please call InputContext::init () !");
         }
+        m_instance->wait ();
         return *m_instance;
     }
+    /* Checks whether the databases are opened, without waiting for it. */
+    static bool ready (void)
+    {
+        return m_instance.get () != NULL && g_atomic_int_get (&m_instance->m_ready);
+    }
 
 private:
+    /* Waits until the databases are opened. Any thread may wait, the
+     * thread opening them is joined by the first one under the lock. */
+    void wait (void)
+    {
+        if (G_UNLIKELY (!g_atomic_int_get (&m_ready)))
+            join ();
+    }
+    void join (void);
+    static gpointer openThread (gpointer data);
     bool open (void);
+    bool openShared (const char *path);
+    void openDict (const char *source);
     bool loadUserDB (void);
+    bool attachUserDB (const char *path);
     bool saveUserDB (void);
     void prefetch (void);
-    void phraseSql (const Phrase & p, String & sql);
-    void phraseWhereSql (const Phrase & p, String & sql);
+    SQLStmtPtr prepareQuery (char                db,
+                             const std::string & shape,
+                             const PinyinArray & pinyin,
+                             size_t              pinyin_begin,
+                             size_t              max_len,
+                             const int          *modes,
+                             int                 m);
+    SQLStmtPtr buildQuery (char db, const std::string & key);
+    void lookupDict (const std::string & shape,
+                     const PinyinArray & pinyin,
+                     size_t              pinyin_begin,
+                     size_t              max_len,
+                     const int          *modes,
+                     PhraseArray       & phrases);
+    std::string keyedWhere (const std::string & key, size_t len);
+    std::string initialsWhere (const std::string & key, size_t len);
+    unsigned int initialsIndexes (const char *db);
+    bool useInitials (char db, const std::string & key, size_t len) const;
+    void bindRanges (SQLStmtPtr          & stmt,
+                     char                  db,
+                     const std::string   & key,
+                     const PinyinArray   & pinyin,
+                     size_t                pinyin_begin,
+                     size_t                max_len);
+    void buildFilter (void);
+    void buildFilterFromDict (std::vector<guint64> & keys);
+    void filterInsert (const Phrase & phrase);
+    void invalidateResults (const Phrase & phrase);
+    /* Resets the half-stepped statements of the cached results, which
+     * keep read transactions open, and so the write-ahead log from being
+     * checkpointed. */
+    void suspendResults (void);
+    bool filterContains (const PinyinArray &pinyin,
+                         size_t             pinyin_begin,
+                         size_t             len,
+                         const int         *modes);
+    void pend (const Phrase & phrase);
+    enum WriteStmt {
+        WRITE_INSERT,
+        WRITE_UPDATE,
+        WRITE_DELETE,
+        WRITE_SELECT,           /* the user_freq of a phrase */
+        WRITE_LAST,
+    };
+    SQLStmtPtr writeStmt (WriteStmt kind, const Phrase & phrase);
+    void writePhrase (const Phrase & phrase, unsigned int count, gint64 atime);
+    void bulkWritten (void);
     bool executeSQL (const char *sql, sqlite3 *db = NULL);
     void modified (void);
     static gboolean timeoutCallback (void * data);
+    static gboolean flushCallback (void * data);
+    bool compactStep (void);
+    void loadHot (void);
+    static gboolean compactCallback (void * data);
 
 private:
     sqlite3 *m_db;              /* sqlite3 database */
@@ -102,8 +251,83 @@ private:
     String m_sql;        /* sql stmt */
     String m_buffer;     /* temp buffer */
     unsigned int m_timeout_id;
+    unsigned int m_flush_id;
+    unsigned int m_compact_id;
     GTimer *m_timer;
     String m_user_data_dir;
+    unsigned int m_flags;       /* INIT_* flags */
+    int m_lock_fd;              /* USER_DB_LOCK_FILE, or -1 */
+    String m_user_journal;      /* journal mode to set back, or empty */
+    bool m_main_keyed;          /* main database has the packed key column */
+    unsigned int m_main_initials;   /* bit len - 1 is set if the phrases of */
+    unsigned int m_user_initials;   /* length len have the initials index */
+    MappedDictionary m_dict;    /* compiled main database, if there is one */
+    gint64 m_freq_total;        /* sum of the freq of the main phrases */
+
+    /* prepared query statements, keyed by the shape of the query */
+    typedef std::map<std::string, SQLStmtPtr> StmtCache;
+    StmtCache m_stmt_cache;
+    unsigned long m_stmt_cache_hits;
+    unsigned long m_stmt_cache_misses;
+
+    /* the costs of the query statements, keyed like the statement cache */
+    typedef std::map<std::string, QueryStatsPtr> QueryStatsMap;
+    QueryStatsMap m_query_stats;
+    bool m_query_stats_enabled;
+
+    /* statements which write the user database, by the phrase length */
+    SQLStmtPtr m_write_stmts[WRITE_LAST][MAX_PHRASE_LEN];
+
+    /* which (length, first syllables) have any phrase */
+    BloomFilter m_filter;
+    unsigned long m_filter_checked;
+    unsigned long m_filter_skipped;
+    unsigned long m_filter_missed;
+
+    /* lru cache of the query results, keyed by the pinyin ids and option */
+    typedef std::list<std::pair<std::string, QueryResultPtr> > ResultList;
+    typedef std::map<std::string, ResultList::iterator> ResultIndex;
+    ResultList m_results;
+    ResultIndex m_result_index;
+    unsigned long m_result_cache_hits;
+    unsigned long m_result_cache_misses;
+
+    /* committed phrases not written to the user database yet, keyed by
+     * the phrase and its pinyin ids */
+    struct Pending {
+        Phrase phrase;          /* with the user_freq after the update */
+        unsigned int count;     /* times committed */
+    };
+    typedef std::map<std::string, Pending> PendingMap;
+    PendingMap m_pending;
+    unsigned int m_pending_commits; /* commits since the last flush */
+
+    /* the size limit of the user database, and the state of compaction */
+    unsigned int m_user_limit;
+    size_t m_user_rows;         /* counted since the limit was set */
+    unsigned int m_user_generation;
+    gint64 m_compact_now;       /* time the scores are decayed to */
+    gint64 m_compact_threshold; /* score of the last phrase to delete, or -1 */
+    size_t m_compact_left;      /* phrases to delete */
+    int m_compact_table;        /* table of the next step */
+    bool m_compact_ties;        /* deleting the phrases at the threshold */
+    bool m_compact_scanning;    /* counting the scores */
+    gint64 m_compact_rowid;     /* last row read of the table */
+    std::map<gint64, size_t> m_compact_scores;  /* phrases by their score */
+
+    /* the hot user phrases */
+    HotPhrases m_hot;
+    unsigned int m_hot_size;
+    unsigned long m_hot_hits;
+    unsigned long m_hot_misses;
+
+    GThread *m_thread;          /* thread opening the databases, until joined */
+#if GLIB_CHECK_VERSION (2, 32, 0)
+    GMutex m_thread_lock;       /* guards m_thread */
+#else
+    GStaticMutex m_thread_lock;
+#endif
+    volatile gint m_ready;      /* set by the thread when it is done */
 
 private:
     static std::unique_ptr<Database> m_instance;
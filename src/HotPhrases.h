@@ -0,0 +1,219 @@
+/* vim:set et ts=4 sts=4:
+ *
+ * libpyzy - The Chinese PinYin and Bopomofo conversion library.
+ *
+ * Copyright (c) 2008-2010 Peng Huang <shawn.p.huang@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#ifndef __PYZY_HOT_PHRASES_H_
+#define __PYZY_HOT_PHRASES_H_
+
+#include <glib.h>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+
+#include "PhraseArray.h"
+
+namespace PyZy {
+
+/* Checks whether a goes before b in the order of the query statements:
+ * longer phrases, user_freq, freq, the text. Of two equal rows, a goes
+ * first. */
+static inline bool
+phrase_before (const Phrase & a, const Phrase & b)
+{
+    if (a.len != b.len)
+        return a.len > b.len;
+    if (a.user_freq != b.user_freq)
+        return a.user_freq > b.user_freq;
+    if (a.freq != b.freq)
+        return a.freq > b.freq;
+    return std::strcmp (a.phrase, b.phrase) <= 0;
+}
+
+/* The user phrases of the highest user_freq, kept in memory. They are
+ * bucketed by the sheng and the yun of the first syllable, and every
+ * bucket is sorted in the order of the queries: longer phrases,
+ * user_freq, freq, the text. The phrases are also ordered by user_freq,
+ * so the coldest one is evicted without a search.
+ *
+ * Every user phrase of a user_freq above threshold () is in the set, and
+ * if complete (), every user phrase is. */
+class HotPhrases {
+public:
+    HotPhrases (void)
+        : m_capacity (0), m_count (0), m_threshold (0), m_complete (false) { }
+
+    /* Empties the set. It is complete until a phrase is evicted. */
+    void reset (size_t capacity)
+    {
+        m_buckets.clear ();
+        m_order.clear ();
+        m_capacity = capacity;
+        m_count = 0;
+        m_threshold = 0;
+        m_complete = capacity > 0;
+    }
+
+    /* Drops every phrase, and does not take any until it is reset. */
+    void clear (void)
+    {
+        reset (0);
+    }
+
+    /* Sets the user_freq of a phrase, adding it if it is hot enough. */
+    void update (const Phrase & phrase)
+    {
+        if (G_UNLIKELY (m_capacity == 0))
+            return;
+
+        PhraseArray & phrases = m_buckets[bucket_key (phrase)];
+        PhraseArray::iterator it = find (phrases, phrase);
+
+        if (it != phrases.end ()) {
+            m_order.erase (std::make_pair (it->user_freq, order_key (*it)));
+            phrases.erase (it);
+        }
+        else {
+            if (!m_complete && phrase.user_freq <= m_threshold) {
+                if (phrases.empty ())
+                    m_buckets.erase (bucket_key (phrase));
+                return;
+            }
+            m_count ++;
+        }
+
+        it = phrases.begin ();
+        while (it != phrases.end () && phrase_before (*it, phrase))
+            ++it;
+        phrases.insert (it, phrase);
+        m_order.insert (std::make_pair (phrase.user_freq, order_key (phrase)));
+
+        if (m_count > m_capacity)
+            evict ();
+    }
+
+    void erase (const Phrase & phrase)
+    {
+        if (G_UNLIKELY (m_capacity == 0))
+            return;
+
+        Buckets::iterator bucket = m_buckets.find (bucket_key (phrase));
+        if (bucket == m_buckets.end ())
+            return;
+        PhraseArray::iterator it = find (bucket->second, phrase);
+        if (it != bucket->second.end ()) {
+            m_order.erase (std::make_pair (it->user_freq, order_key (*it)));
+            bucket->second.erase (it);
+            m_count --;
+        }
+        if (bucket->second.empty ())
+            m_buckets.erase (bucket);
+    }
+
+    /* Marks the phrases of a user_freq up to threshold as not all in the
+     * set, as when only some of them were loaded. */
+    void truncate (unsigned int threshold)
+    {
+        m_threshold = MAX (m_threshold, threshold);
+        m_complete = false;
+    }
+
+    /* The phrases of which the first syllable has the sheng and the yun,
+     * or NULL if there is none. */
+    const PhraseArray * bucket (unsigned int sheng, unsigned int yun) const
+    {
+        Buckets::const_iterator it = m_buckets.find ((sheng << 8) | yun);
+        return it != m_buckets.end () ? &it->second : NULL;
+    }
+
+    bool enabled (void) const           { return m_capacity > 0; }
+    size_t size (void) const            { return m_count; }
+    size_t capacity (void) const        { return m_capacity; }
+    unsigned int threshold (void) const { return m_threshold; }
+    bool complete (void) const          { return m_complete; }
+
+private:
+    static unsigned int bucket_key (const Phrase & phrase)
+    {
+        return (phrase.pinyin_id[0].sheng << 8) | phrase.pinyin_id[0].yun;
+    }
+
+    /* The pinyin ids of a phrase followed by its text. */
+    static std::string order_key (const Phrase & phrase)
+    {
+        std::string key ((const char *) phrase.pinyin_id,
+                         phrase.len * sizeof (phrase.pinyin_id[0]));
+        return key.append (phrase.phrase);
+    }
+
+    static PhraseArray::iterator find (PhraseArray & bucket, const Phrase & phrase)
+    {
+        PhraseArray::iterator it;
+        for (it = bucket.begin (); it != bucket.end (); ++it) {
+            if (it->len == phrase.len &&
+                std::memcmp (it->pinyin_id, phrase.pinyin_id,
+                             phrase.len * sizeof (phrase.pinyin_id[0])) == 0 &&
+                std::strcmp (it->phrase, phrase.phrase) == 0)
+                break;
+        }
+        return it;
+    }
+
+    /* Drops a phrase of the lowest user_freq. */
+    void evict (void)
+    {
+        Order::iterator lowest = m_order.begin ();
+        const std::string & key = lowest->second;
+        unsigned int sheng = (unsigned char) key[0];
+        unsigned int yun = (unsigned char) key[1];
+        Buckets::iterator bucket = m_buckets.find ((sheng << 8) | yun);
+
+        /* the key has two bytes of every pinyin id and the text after */
+        PhraseArray::iterator it;
+        for (it = bucket->second.begin (); it != bucket->second.end (); ++it) {
+            size_t ids = it->len * sizeof (it->pinyin_id[0]);
+            if (key.size () > ids &&
+                std::memcmp (key.data (), it->pinyin_id, ids) == 0 &&
+                std::strcmp (key.c_str () + ids, it->phrase) == 0)
+                break;
+        }
+
+        truncate (lowest->first);
+        bucket->second.erase (it);
+        if (bucket->second.empty ())
+            m_buckets.erase (bucket);
+        m_order.erase (lowest);
+        m_count --;
+    }
+
+private:
+    typedef std::map<unsigned int, PhraseArray> Buckets;
+    typedef std::set<std::pair<unsigned int, std::string> > Order;
+    Buckets m_buckets;          /* keyed by the sheng and the yun */
+    Order m_order;              /* user_freq and order_key of every phrase */
+    size_t m_capacity;
+    size_t m_count;
+    unsigned int m_threshold;
+    bool m_complete;
+};
+
+};  // namespace PyZy
+
+#endif  // __PYZY_HOT_PHRASES_H_
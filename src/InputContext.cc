@@ -28,6 +28,8 @@
 #include "Database.h"
 #include "DoublePinyinContext.h"
 #include "FullPinyinContext.h"
+#include "PhraseSource.h"
+#include "Trainer.h"
 
 namespace PyZy {
 
@@ -46,6 +48,14 @@ InputContext::init ()
 void
 InputContext::init (const std::string & user_cache_dir,
                     const std::string & user_config_dir)
+{
+    init (user_cache_dir, user_config_dir, 0);
+}
+
+void
+InputContext::init (const std::string & user_cache_dir,
+                    const std::string & user_config_dir,
+                    unsigned int        flags)
 {
     if (user_cache_dir.empty ()) {
         g_error ("Error: user_cache_dir should not be empty");
@@ -54,14 +64,85 @@ InputContext::init (const std::string & user_cache_dir,
         g_error ("Error: user_config_dir should not be empty");
     }
 
-    Database::init (user_cache_dir);
+    PhraseSource::init (user_cache_dir, flags);
     SpecialPhraseTable::init (user_config_dir);
 }
 
+bool
+InputContext::isReady ()
+{
+    return Database::ready ();
+}
+
+void
+InputContext::setUserPhraseLimit (unsigned int max_phrases)
+{
+    Database::instance ().setUserLimit (max_phrases);
+}
+
+void
+InputContext::setHotPhraseLimit (unsigned int max_phrases)
+{
+    Database::instance ().setHotSize (max_phrases);
+}
+
+bool
+InputContext::trainUserPhrases (const std::vector<std::string> & paths,
+                                 unsigned int                     threads)
+{
+    Trainer trainer (threads);
+    bool ret = true;
+
+    for (size_t i = 0; i < paths.size (); i++) {
+        if (!trainer.count (paths[i]))
+            ret = false;
+    }
+    trainer.commit ();
+    return ret;
+}
+
+bool
+InputContext::exportUserPhrases (const std::string & path)
+{
+    return Database::instance ().exportUserPhrases (path.c_str ());
+}
+
+bool
+InputContext::importUserPhrases (const std::string & path)
+{
+    return Database::instance ().importUserPhrases (path.c_str ());
+}
+
+void
+InputContext::setQueryStats (bool enable)
+{
+    Database::instance ().setQueryStats (enable);
+}
+
+std::string
+InputContext::queryStats ()
+{
+    return Database::instance ().queryStatsReport ();
+}
+
+bool
+InputContext::dumpQueryStats (const std::string & path)
+{
+    std::string report = Database::instance ().queryStatsReport ();
+    GError *error = NULL;
+
+    if (!g_file_set_contents (path.c_str (), report.c_str (), report.size (), &error)) {
+        g_warning ("%s", error->message);
+        g_error_free (error);
+        return false;
+    }
+    return true;
+}
+
 void
 InputContext::finalize ()
 {
-    Database::finalize ();
+    PhraseSource::finalize ();
 }
 
 InputContext *
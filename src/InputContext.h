@@ -206,6 +206,15 @@ public:
          * Default value is true.
          */
         PROPERTY_MODE_SIMP,
+        /**
+         * \brief Beam width of the first candidate.
+         *
+         * The number of phrase lengths tried at each position when the
+         * first candidate is segmented. 0 tries every length, and 1 takes
+         * the longest phrase greedily.
+         * Default value is 4.
+         */
+        PROPERTY_BEAM_WIDTH,
     };
 
     /**
@@ -399,6 +408,115 @@ public:
     static void init (const std::string & user_cache_dir,
                       const std::string & user_config_dir);
 
+    /**
+     * \brief Initializes a InputContext class.
+     * @param user_cache_dir Directory which stores a user cache data.
+     * @param user_config_dir Directory which stores a user config data.
+     * @param flags Bitwise OR of INIT_* flags.
+     * @see Const.h
+     *
+     * Same as init (user_cache_dir, user_config_dir), with flags which
+     * change how the user data are stored, and where the phrases are
+     * looked up.
+     */
+    static void init (const std::string & user_cache_dir,
+                      const std::string & user_config_dir,
+                      unsigned int        flags);
+
+    /**
+     * \brief Checks whether the dictionaries are loaded.
+     * @return true if they are loaded.
+     *
+     * init () loads the dictionaries in a thread and returns at once.
+     * Anything which needs them, such as the first candidate, waits until
+     * they are loaded. This function does not wait.
+     */
+    static bool isReady ();
+
+    /**
+     * \brief Limits the phrases in the user dictionary.
+     * @param max_phrases The maximum number of phrases, or 0 for no limit.
+     *
+     * When the user dictionary has more phrases, the ones which were used
+     * least and longest ago are removed in idle time of the main loop.
+     * It should be called after init (). No limit by default.
+     */
+    static void setUserPhraseLimit (unsigned int max_phrases);
+
+    /**
+     * \brief Sets how many user phrases are kept in memory.
+     * @param max_phrases The number of phrases, or 0 to keep none.
+     *
+     * The user phrases which were used most are kept in memory, and the
+     * candidates are looked up there first. If the user dictionary is not
+     * larger, it is not queried at all. 2048 by default.
+     */
+    static void setHotPhraseLimit (unsigned int max_phrases);
+
+    /**
+     * \brief Learns the user phrases from text files.
+     * @param paths UTF-8 text files.
+     * @param threads The number of threads, or 0 for one per processor.
+     * @return false if a file can not be read.
+     *
+     * The text is cut into the phrases of the system dictionary, and how
+     * often every phrase occurs is added to its frequency in the user
+     * dictionary, as if it was committed as many times. The files which
+     * can be read are learned even if others can not.
+     */
+    static bool trainUserPhrases (const std::vector<std::string> & paths,
+                                  unsigned int                     threads);
+
+    /**
+     * \brief Writes the user dictionary to a text file.
+     * @param path The file to write.
+     * @return false if the file can not be written.
+     *
+     * Every user phrase is written on a line with its pinyin and
+     * frequencies, so the file can be read by importUserPhrases () on
+     * another machine.
+     */
+    static bool exportUserPhrases (const std::string & path);
+
+    /**
+     * \brief Merges a file of exportUserPhrases () into the user dictionary.
+     * @param path The file to read.
+     * @return false if the file can not be read.
+     *
+     * The frequency of a phrase which is already in the user dictionary is
+     * added to it. Lines which are not phrases are skipped.
+     */
+    static bool importUserPhrases (const std::string & path);
+
+    /**
+     * \brief Records what the dictionary queries cost.
+     * @param enable true to start recording, false to stop.
+     *
+     * The queries are grouped by their shape, which is the same for
+     * inputs of the same number of syllables with the same fuzzy and
+     * incomplete pinyins. Starting drops the earlier records. Stopped by
+     * default, as timing every query costs a little.
+     */
+    static void setQueryStats (bool enable);
+
+    /**
+     * \brief Gets the recorded costs of the dictionary queries.
+     * @return A table of one line per query shape, the slowest first.
+     *
+     * Every line has how many times the queries ran, the time to prepare
+     * and step them, the rows they read, how many rows of full table
+     * scans and how many sorts SQLite did, percentiles of the time of one
+     * query, and the pinyin of the first query of the shape.
+     */
+    static std::string queryStats ();
+
+    /**
+     * \brief Writes the table of queryStats () to a file.
+     * @param path The file to write.
+     * @return false if the file can not be written.
+     */
+    static bool dumpQueryStats (const std::string & path);
+
     /**
      * \brief Finalizes a InputContext class.
      *
@@ -0,0 +1,646 @@
+/* vim:set et ts=4 sts=4:
+ *
+ * libpyzy - The Chinese PinYin and Bopomofo conversion library.
+ *
+ * Copyright (c) 2008-2010 Peng Huang <shawn.p.huang@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#include "MappedDictionary.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <sqlite3.h>
+
+#include "String.h"
+
+#if defined (__x86_64__) || defined (__i386__)
+#if defined (__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#define MAPPED_DICT_SIMD        (1)
+#include <immintrin.h>
+#endif
+#endif
+
+namespace PyZy {
+
+#define MAPPED_DICT_MAGIC       "PYZYDICT"
+#define MAPPED_DICT_VERSION     (1)
+#define MAPPED_DICT_BYTE_ORDER  (0x01020304)
+
+/* The leading syllables of a lookup are searched with at most this many
+ * ranges of rows, the other syllables are tested row by row. */
+#define MAPPED_DICT_RANGES      (6)
+
+struct MappedDictHeader {
+    char magic[8];
+    guint32 version;
+    guint32 byte_order;
+    guint64 source_size;
+    gint64 source_mtime;
+    guint32 pool_offset;
+    guint32 pool_size;
+    struct {
+        guint32 rows;
+        guint32 offset;
+    } tables[MAX_PHRASE_LEN];
+};
+
+/* The bytes of a table of rows phrases of length len: the syllable
+ * columns padded to 4 bytes, then the freq, rank and text columns. */
+static inline size_t
+table_size (size_t len, size_t rows)
+{
+    return ((len * rows * sizeof (guint16) + 3) & ~(size_t) 3) + rows * sizeof (guint32) * 3;
+}
+
+MappedDictionary::MappedDictionary (void)
+    : m_file (NULL)
+    , m_pool (NULL)
+    , m_pool_size (0)
+{
+    std::memset (m_tables, 0, sizeof (m_tables));
+}
+
+MappedDictionary::~MappedDictionary (void)
+{
+    close ();
+}
+
+bool
+MappedDictionary::open (const char *path, const char *source)
+{
+    close ();
+
+    struct stat st;
+    if (g_stat (source, &st) != 0)
+        return false;
+
+    /* the dictionary is optional, it is not an error if there is none */
+    GMappedFile *file = g_mapped_file_new (path, FALSE, NULL);
+    if (file == NULL)
+        return false;
+
+    const char *data = g_mapped_file_get_contents (file);
+    size_t size = g_mapped_file_get_length (file);
+    const MappedDictHeader *header = (const MappedDictHeader *) data;
+
+    do {
+        if (size < sizeof (*header) ||
+            std::memcmp (header->magic, MAPPED_DICT_MAGIC, sizeof (header->magic)) != 0 ||
+            header->version != MAPPED_DICT_VERSION ||
+            header->byte_order != MAPPED_DICT_BYTE_ORDER) {
+            g_warning ("%s is not a compiled dictionary of this machine", path);
+            break;
+        }
+        if (header->source_size != (guint64) st.st_size ||
+            header->source_mtime != (gint64) st.st_mtime) {
+            g_warning ("%s was not compiled from %s as it is now", path, source);
+            break;
+        }
+        if (header->pool_size == 0 ||
+            (size_t) header->pool_offset + header->pool_size > size ||
+            data[header->pool_offset + header->pool_size - 1] != 0)
+            break;
+
+        size_t len;
+        for (len = 1; len <= MAX_PHRASE_LEN; len++) {
+            Table & table = m_tables[len - 1];
+            size_t rows = header->tables[len - 1].rows;
+            size_t offset = header->tables[len - 1].offset;
+
+            if (offset % 4 != 0 || offset + table_size (len, rows) > size)
+                break;
+
+            const guint16 *syllables = (const guint16 *) (data + offset);
+            const guint32 *columns = (const guint32 *) (data + offset + table_size (len, rows) -
+                                                        rows * sizeof (guint32) * 3);
+            table.rows = rows;
+            for (size_t i = 0; i < len; i++)
+                table.syllables[i] = syllables + i * rows;
+            table.freq = columns;
+            table.rank = columns + rows;
+            table.text = columns + rows * 2;
+        }
+        if (len <= MAX_PHRASE_LEN) {
+            g_warning ("%s is broken", path);
+            break;
+        }
+
+        m_file = file;
+        m_pool = data + header->pool_offset;
+        m_pool_size = header->pool_size;
+        return true;
+    } while (0);
+
+    std::memset (m_tables, 0, sizeof (m_tables));
+#if GLIB_CHECK_VERSION (2, 22, 0)
+    g_mapped_file_unref (file);
+#else
+    g_mapped_file_free (file);
+#endif
+    return false;
+}
+
+void
+MappedDictionary::close (void)
+{
+    if (m_file == NULL)
+        return;
+
+#if GLIB_CHECK_VERSION (2, 22, 0)
+    g_mapped_file_unref (m_file);
+#else
+    g_mapped_file_free (m_file);
+#endif
+    m_file = NULL;
+    m_pool = NULL;
+    m_pool_size = 0;
+    std::memset (m_tables, 0, sizeof (m_tables));
+}
+
+namespace {
+
+/* A column of syllables which a scan tests. The scalar scan tests the
+ * ids with the mask. The vector scans compare the syllables masked with
+ * 0xff00 with the shengs, sheng << 8, and the syllables masked with
+ * yun_mask with the yuns; yun_mask is 0 if every yun is accepted. The
+ * unused shengs and yuns repeat the first one. */
+struct ScanColumn {
+    const guint16 *syllables;
+    PinyinMask mask;
+    guint16 shengs[3];
+    guint16 yun_mask;
+    guint16 yuns[2];
+};
+
+/* Appends the rows from begin to end which every column accepts. */
+typedef void (*ScanKernel) (const ScanColumn        *columns,
+                            size_t                   ncolumns,
+                            size_t                   begin,
+                            size_t                   end,
+                            std::vector<guint32>    &rows);
+
+void
+scan_scalar (const ScanColumn       *columns,
+             size_t                  ncolumns,
+             size_t                  begin,
+             size_t                  end,
+             std::vector<guint32>   &rows)
+{
+    for (size_t row = begin; row < end; row++) {
+        size_t i;
+        for (i = 0; i < ncolumns; i++) {
+            guint16 syllable = columns[i].syllables[row];
+            if (!columns[i].mask.check (MAPPED_DICT_SHENG (syllable),
+                                        MAPPED_DICT_YUN (syllable)))
+                break;
+        }
+        if (i == ncolumns)
+            rows.push_back (row);
+    }
+}
+
+#ifdef MAPPED_DICT_SIMD
+
+/* 8 rows at once, one 16-bit lane per row */
+__attribute__ ((target ("sse2"))) void
+scan_sse2 (const ScanColumn     *columns,
+           size_t                ncolumns,
+           size_t                begin,
+           size_t                end,
+           std::vector<guint32> &rows)
+{
+    const __m128i sheng_mask = _mm_set1_epi16 ((short) 0xff00);
+    size_t row = begin;
+
+    for (; row + 8 <= end; row += 8) {
+        __m128i matched = _mm_set1_epi16 (-1);
+        for (size_t i = 0; i < ncolumns; i++) {
+            const ScanColumn & c = columns[i];
+            __m128i v = _mm_loadu_si128 ((const __m128i *) (c.syllables + row));
+            __m128i sheng = _mm_and_si128 (v, sheng_mask);
+            __m128i yun = _mm_and_si128 (v, _mm_set1_epi16 (c.yun_mask));
+            __m128i s = _mm_or_si128 (
+                _mm_or_si128 (_mm_cmpeq_epi16 (sheng, _mm_set1_epi16 (c.shengs[0])),
+                              _mm_cmpeq_epi16 (sheng, _mm_set1_epi16 (c.shengs[1]))),
+                _mm_cmpeq_epi16 (sheng, _mm_set1_epi16 (c.shengs[2])));
+            __m128i y = _mm_or_si128 (_mm_cmpeq_epi16 (yun, _mm_set1_epi16 (c.yuns[0])),
+                                      _mm_cmpeq_epi16 (yun, _mm_set1_epi16 (c.yuns[1])));
+            matched = _mm_and_si128 (matched, _mm_and_si128 (s, y));
+            if (_mm_movemask_epi8 (matched) == 0)
+                break;
+        }
+
+        /* two bits of the byte mask per row */
+        unsigned int bits = _mm_movemask_epi8 (matched) & 0x5555;
+        for (; bits != 0; bits &= bits - 1)
+            rows.push_back (row + __builtin_ctz (bits) / 2);
+    }
+    scan_scalar (columns, ncolumns, row, end, rows);
+}
+
+/* 16 rows at once */
+__attribute__ ((target ("avx2"))) void
+scan_avx2 (const ScanColumn     *columns,
+           size_t                ncolumns,
+           size_t                begin,
+           size_t                end,
+           std::vector<guint32> &rows)
+{
+    const __m256i sheng_mask = _mm256_set1_epi16 ((short) 0xff00);
+    size_t row = begin;
+
+    for (; row + 16 <= end; row += 16) {
+        __m256i matched = _mm256_set1_epi16 (-1);
+        for (size_t i = 0; i < ncolumns; i++) {
+            const ScanColumn & c = columns[i];
+            __m256i v = _mm256_loadu_si256 ((const __m256i *) (c.syllables + row));
+            __m256i sheng = _mm256_and_si256 (v, sheng_mask);
+            __m256i yun = _mm256_and_si256 (v, _mm256_set1_epi16 (c.yun_mask));
+            __m256i s = _mm256_or_si256 (
+                _mm256_or_si256 (_mm256_cmpeq_epi16 (sheng, _mm256_set1_epi16 (c.shengs[0])),
+                                 _mm256_cmpeq_epi16 (sheng, _mm256_set1_epi16 (c.shengs[1]))),
+                _mm256_cmpeq_epi16 (sheng, _mm256_set1_epi16 (c.shengs[2])));
+            __m256i y = _mm256_or_si256 (_mm256_cmpeq_epi16 (yun, _mm256_set1_epi16 (c.yuns[0])),
+                                         _mm256_cmpeq_epi16 (yun, _mm256_set1_epi16 (c.yuns[1])));
+            matched = _mm256_and_si256 (matched, _mm256_and_si256 (s, y));
+            if (_mm256_testz_si256 (matched, matched))
+                break;
+        }
+
+        unsigned int bits = (unsigned int) _mm256_movemask_epi8 (matched) & 0x55555555U;
+        for (; bits != 0; bits &= bits - 1)
+            rows.push_back (row + __builtin_ctz (bits) / 2);
+    }
+    scan_scalar (columns, ncolumns, row, end, rows);
+}
+
+bool
+avx2_supported (void)
+{
+    return __builtin_cpu_supports ("avx2");
+}
+
+bool
+sse2_supported (void)
+{
+    return __builtin_cpu_supports ("sse2");
+}
+
+#endif  // MAPPED_DICT_SIMD
+
+const struct {
+    const char *name;
+    ScanKernel scan;
+    bool (*supported) (void);
+} scan_kernels[] = {
+#ifdef MAPPED_DICT_SIMD
+    { "avx2",   scan_avx2,      avx2_supported },
+    { "sse2",   scan_sse2,      sse2_supported },
+#endif
+    { "scalar", scan_scalar,    NULL },
+};
+
+/* the index of the kernel in scan_kernels, -1 until it is chosen */
+int scan_kernel = -1;
+
+inline ScanKernel
+get_scan_kernel (void)
+{
+    if (G_UNLIKELY (scan_kernel < 0))
+        MappedDictionary::setScanKernel (NULL);
+    return scan_kernels[scan_kernel].scan;
+}
+
+};  // namespace
+
+bool
+MappedDictionary::setScanKernel (const char *name)
+{
+    for (size_t i = 0; i < G_N_ELEMENTS (scan_kernels); i++) {
+        if (name != NULL && std::strcmp (name, scan_kernels[i].name) != 0)
+            continue;
+        if (scan_kernels[i].supported != NULL && !scan_kernels[i].supported ())
+            continue;
+        scan_kernel = i;
+        return true;
+    }
+    return false;
+}
+
+const char *
+MappedDictionary::scanKernel (void)
+{
+    get_scan_kernel ();
+    return scan_kernels[scan_kernel].name;
+}
+
+void
+MappedDictionary::lookup (const Syllable *syllables, size_t len, PhraseArray & phrases) const
+{
+    const Table & table = m_tables[len - 1];
+    if (table.rows == 0)
+        return;
+
+    /* the leading syllables of which every combination of the ids is a
+     * range of rows; a syllable without yun is a range itself, so it is
+     * the last of them */
+    size_t prefix = 0;
+    size_t ranges = 1;
+    while (prefix < len) {
+        const Syllable & s = syllables[prefix];
+        size_t alternatives = s.nsheng * (s.nyun == 0 ? 1 : s.nyun);
+
+        if (ranges * alternatives > MAPPED_DICT_RANGES)
+            break;
+        ranges *= alternatives;
+        prefix ++;
+        if (s.nyun == 0)
+            break;
+    }
+
+    /* the other syllables are scanned in the ranges */
+    ScanColumn columns[MAX_PHRASE_LEN];
+    size_t ncolumns = 0;
+    for (size_t i = prefix; i < len; i++, ncolumns++) {
+        const Syllable & s = syllables[i];
+        ScanColumn & c = columns[ncolumns];
+
+        c.syllables = table.syllables[i];
+        c.mask = s.mask;
+        for (size_t j = 0; j < G_N_ELEMENTS (c.shengs); j++)
+            c.shengs[j] = MAPPED_DICT_SYLLABLE (s.shengs[j < s.nsheng ? j : 0], 0);
+        c.yun_mask = s.nyun == 0 ? 0 : 0xff;
+        for (size_t j = 0; j < G_N_ELEMENTS (c.yuns); j++)
+            c.yuns[j] = s.nyun == 0 ? 0 : s.yuns[j < s.nyun ? j : 0];
+    }
+    ScanKernel scan = get_scan_kernel ();
+
+    /* (rank, row) of the matched rows */
+    std::vector<std::pair<guint32, guint32> > matches;
+    std::vector<guint32> rows;
+
+    for (size_t r = 0; r < ranges; r++) {
+        size_t begin = 0;
+        size_t end = table.rows;
+        size_t n = r;
+
+        for (size_t i = 0; i < prefix && begin < end; i++) {
+            const Syllable & s = syllables[i];
+            const guint16 *column = table.syllables[i];
+            unsigned int sheng = s.shengs[n % s.nsheng];
+            n /= s.nsheng;
+
+            guint16 lo, hi;
+            if (s.nyun == 0) {
+                lo = MAPPED_DICT_SYLLABLE (sheng, 0);
+                hi = MAPPED_DICT_SYLLABLE (sheng, 0xff);
+            }
+            else {
+                lo = hi = MAPPED_DICT_SYLLABLE (sheng, s.yuns[n % s.nyun]);
+                n /= s.nyun;
+            }
+
+            /* the rows in the range have the same earlier syllables, so
+             * they are sorted by this one */
+            begin = std::lower_bound (column + begin, column + end, lo) - column;
+            end = std::upper_bound (column + begin, column + end, hi) - column;
+        }
+
+        rows.clear ();
+        scan (columns, ncolumns, begin, end, rows);
+        for (size_t i = 0; i < rows.size (); i++)
+            matches.push_back (std::make_pair (table.rank[rows[i]], rows[i]));
+    }
+
+    std::sort (matches.begin (), matches.end ());
+
+    size_t size = phrases.size ();
+    phrases.resize (size + matches.size ());
+    for (size_t i = 0; i < matches.size (); i++)
+        readRow (table, len, matches[i].second, phrases[size + i]);
+}
+
+void
+MappedDictionary::readRow (const Table & table, size_t len, guint32 row, Phrase & phrase) const
+{
+    guint32 text = table.text[row];
+
+    g_strlcpy (phrase.phrase, text < m_pool_size ? m_pool + text : "", sizeof (phrase.phrase));
+    phrase.freq = table.freq[row];
+    phrase.user_freq = 0;
+    phrase.len = len;
+    for (size_t i = 0; i < len; i++) {
+        phrase.pinyin_id[i].sheng = MAPPED_DICT_SHENG (table.syllables[i][row]);
+        phrase.pinyin_id[i].yun = MAPPED_DICT_YUN (table.syllables[i][row]);
+    }
+}
+
+namespace {
+
+struct CompiledRow {
+    guint16 syllables[MAX_PHRASE_LEN];
+    guint32 freq;
+    guint32 text;
+    const char *phrase;     /* in the pool map */
+};
+
+struct SyllablesBefore {
+    size_t len;
+    bool operator () (const CompiledRow & a, const CompiledRow & b) const {
+        for (size_t i = 0; i < len; i++) {
+            if (a.syllables[i] != b.syllables[i])
+                return a.syllables[i] < b.syllables[i];
+        }
+        if (a.freq != b.freq)
+            return a.freq > b.freq;
+        return std::strcmp (a.phrase, b.phrase) < 0;
+    }
+};
+
+struct CandidateBefore {
+    const std::vector<CompiledRow> *rows;
+    bool operator () (guint32 a, guint32 b) const {
+        const CompiledRow & ra = (*rows)[a];
+        const CompiledRow & rb = (*rows)[b];
+        if (ra.freq != rb.freq)
+            return ra.freq > rb.freq;
+        int cmp = std::strcmp (ra.phrase, rb.phrase);
+        if (cmp != 0)
+            return cmp < 0;
+        return a < b;
+    }
+};
+
+};
+
+bool
+MappedDictionary::compile (const char *source, const char *path)
+{
+    struct stat st;
+    if (g_stat (source, &st) != 0) {
+        g_warning ("Can not stat %s", source);
+        return false;
+    }
+
+    sqlite3 *db = NULL;
+    if (sqlite3_open_v2 (source, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+        g_warning ("Can not open %s: %s", source, sqlite3_errmsg (db));
+        sqlite3_close (db);
+        return false;
+    }
+
+    MappedDictHeader header;
+    std::memset (&header, 0, sizeof (header));
+    std::memcpy (header.magic, MAPPED_DICT_MAGIC, sizeof (header.magic));
+    header.version = MAPPED_DICT_VERSION;
+    header.byte_order = MAPPED_DICT_BYTE_ORDER;
+    header.source_size = st.st_size;
+    header.source_mtime = st.st_mtime;
+
+    /* the texts are shared by the rows of the same phrase */
+    std::map<std::string, guint32> texts;
+    std::string pool;
+    std::vector<std::vector<guint32> > tables (MAX_PHRASE_LEN);
+    size_t total = 0;
+
+    for (size_t len = 1; len <= MAX_PHRASE_LEN; len++) {
+        String sql ("SELECT phrase,freq");
+        for (size_t i = 0; i < len; i++)
+            sql.appendPrintf (",s%d,y%d", (int) i, (int) i);
+        sql.appendPrintf (" FROM py_phrase_%d", (int) len - 1);
+
+        std::vector<CompiledRow> rows;
+        sqlite3_stmt *stmt = NULL;
+        if (sqlite3_prepare_v2 (db, sql.c_str (), -1, &stmt, NULL) == SQLITE_OK) {
+            while (sqlite3_step (stmt) == SQLITE_ROW) {
+                const char *text = (const char *) sqlite3_column_text (stmt, 0);
+                CompiledRow row;
+
+                std::map<std::string, guint32>::iterator it =
+                    texts.insert (std::make_pair (text ? text : "", (guint32) pool.size ())).first;
+                if (it->second == pool.size ()) {
+                    pool.append (it->first);
+                    pool.append (1, '\0');
+                }
+                row.text = it->second;
+                row.phrase = it->first.c_str ();
+                row.freq = sqlite3_column_int (stmt, 1);
+                for (size_t i = 0; i < len; i++) {
+                    row.syllables[i] = MAPPED_DICT_SYLLABLE (sqlite3_column_int (stmt, 2 + i * 2) & 0xff,
+                                                             sqlite3_column_int (stmt, 3 + i * 2) & 0xff);
+                }
+                rows.push_back (row);
+            }
+        }
+        sqlite3_finalize (stmt);
+
+        SyllablesBefore syllables_before = { len };
+        std::sort (rows.begin (), rows.end (), syllables_before);
+
+        std::vector<guint32> order (rows.size ());
+        for (size_t i = 0; i < rows.size (); i++)
+            order[i] = i;
+        CandidateBefore candidate_before = { &rows };
+        std::sort (order.begin (), order.end (), candidate_before);
+
+        std::vector<guint32> rank (rows.size ());
+        for (size_t i = 0; i < order.size (); i++)
+            rank[order[i]] = i;
+
+        /* table_size () is a multiple of 4 */
+        std::vector<guint32> & table = tables[len - 1];
+        table.resize (table_size (len, rows.size ()) / sizeof (guint32) + 1, 0);
+        guint16 *syllables = (guint16 *) &table[0];
+        guint32 *columns = &table[0] + table.size () - 1 - rows.size () * 3;
+        for (size_t row = 0; row < rows.size (); row++) {
+            for (size_t i = 0; i < len; i++)
+                syllables[i * rows.size () + row] = rows[row].syllables[i];
+            columns[row] = rows[row].freq;
+            columns[rows.size () + row] = rank[row];
+            columns[rows.size () * 2 + row] = rows[row].text;
+        }
+
+        header.tables[len - 1].rows = rows.size ();
+        total += rows.size ();
+    }
+    sqlite3_close (db);
+
+    if (total == 0) {
+        g_warning ("%s has no phrases", source);
+        return false;
+    }
+
+    /* the tables are aligned to 8 bytes */
+    size_t offset = sizeof (header);
+    for (size_t len = 1; len <= MAX_PHRASE_LEN; len++) {
+        offset = (offset + 7) & ~(size_t) 7;
+        header.tables[len - 1].offset = offset;
+        offset += table_size (len, header.tables[len - 1].rows);
+    }
+    header.pool_offset = offset;
+    header.pool_size = pool.size ();
+
+    /* a unique file next to path, so compilers of the same dictionary do
+     * not write into one file, and the rename does not cross devices */
+    gchar *tmpfile = g_strdup_printf ("%s.XXXXXX", path);
+    int fd = g_mkstemp (tmpfile);
+    FILE *file = NULL;
+    if (fd >= 0) {
+        fchmod (fd, 0644);
+        if ((file = fdopen (fd, "wb")) == NULL)
+            ::close (fd);
+    }
+    if (file == NULL) {
+        g_warning ("Can not open %s", tmpfile);
+        if (fd >= 0)
+            g_unlink (tmpfile);
+        g_free (tmpfile);
+        return false;
+    }
+
+    static const char zeros[8] = { 0 };
+    fwrite (&header, 1, sizeof (header), file);
+    offset = sizeof (header);
+    for (size_t len = 1; len <= MAX_PHRASE_LEN; len++) {
+        size_t size = table_size (len, header.tables[len - 1].rows);
+        fwrite (zeros, 1, header.tables[len - 1].offset - offset, file);
+        fwrite (&tables[len - 1][0], 1, size, file);
+        offset = header.tables[len - 1].offset + size;
+    }
+    fwrite (pool.data (), 1, pool.size (), file);
+
+    bool retval = !ferror (file);
+    if (fclose (file) != 0)
+        retval = false;
+    if (retval && g_rename (tmpfile, path) != 0)
+        retval = false;
+    if (!retval) {
+        g_warning ("Can not write %s", path);
+        g_unlink (tmpfile);
+    }
+    g_free (tmpfile);
+    return retval;
+}
+
+};  // namespace PyZy
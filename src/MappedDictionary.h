@@ -0,0 +1,113 @@
+/* vim:set et ts=4 sts=4:
+ *
+ * libpyzy - The Chinese PinYin and Bopomofo conversion library.
+ *
+ * Copyright (c) 2008-2010 Peng Huang <shawn.p.huang@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#ifndef __PYZY_MAPPED_DICTIONARY_H_
+#define __PYZY_MAPPED_DICTIONARY_H_
+
+#include <glib.h>
+
+#include "PhraseArray.h"
+#include "PinyinOption.h"
+
+namespace PyZy {
+
+/* A syllable of a phrase in the compiled dictionary: sheng << 8 | yun. */
+#define MAPPED_DICT_SYLLABLE(sheng, yun)    ((guint16) (((sheng) << 8) | (yun)))
+#define MAPPED_DICT_SHENG(syllable)         ((syllable) >> 8)
+#define MAPPED_DICT_YUN(syllable)           ((syllable) & 0xff)
+
+/* A compiled, read-only main dictionary, which is mapped into memory and
+ * read in place. It is compiled from the py_phrase_N tables of a main
+ * database by compile () or pyzy-compile-dict.
+ *
+ * The file has a header, a table for every phrase length, and a pool of
+ * the NUL-terminated phrase texts. A table of phrases of length len has
+ * len columns of syllables, one per syllable of the phrases, then the
+ * columns of freq, rank and text, the offset of the text in the pool.
+ * The rows are sorted by the syllables, so the phrases of the same
+ * leading syllables are a range of rows. rank is the position of a row
+ * in the order of the candidates: freq descending, then the text.
+ *
+ * The file is in the byte order of the machine which compiled it. The
+ * header records the size and mtime of the database it was compiled
+ * from, and the dictionary is not used if that database changed. */
+class MappedDictionary {
+public:
+    /* The ids a syllable of the input accepts. nyun is 0 if it accepts
+     * every yun. mask has the same ids, to check the rows. */
+    struct Syllable {
+        unsigned char shengs[3];
+        unsigned char yuns[2];
+        unsigned char nsheng;
+        unsigned char nyun;
+        PinyinMask mask;
+    };
+
+    MappedDictionary (void);
+    ~MappedDictionary (void);
+
+    /* Maps the compiled dictionary of the database source. */
+    bool open (const char *path, const char *source);
+    void close (void);
+    bool opened (void) const            { return m_file != NULL; }
+
+    size_t rows (size_t len) const      { return m_tables[len - 1].rows; }
+    guint16 syllable (size_t len, size_t row, size_t i) const
+    {
+        return m_tables[len - 1].syllables[i][row];
+    }
+
+    /* Appends the phrases of length len of which every syllable is
+     * accepted, in the order of the candidates. */
+    void lookup (const Syllable *syllables, size_t len, PhraseArray & phrases) const;
+
+    /* Chooses the kernel which tests the rows in the ranges of the
+     * leading syllables against the other syllables: "avx2", "sse2" or
+     * "scalar". By default it is the fastest one the processor supports,
+     * and name NULL chooses that again. Returns false if the processor
+     * does not support the kernel. */
+    static bool setScanKernel (const char *name);
+    static const char *scanKernel (void);
+
+    /* Compiles the main database source into the file path. */
+    static bool compile (const char *source, const char *path);
+
+private:
+    struct Table {
+        size_t rows;
+        const guint16 *syllables[MAX_PHRASE_LEN];
+        const guint32 *freq;
+        const guint32 *rank;
+        const guint32 *text;
+    };
+
+    void readRow (const Table & table, size_t len, guint32 row, Phrase & phrase) const;
+
+private:
+    GMappedFile *m_file;
+    Table m_tables[MAX_PHRASE_LEN];
+    const char *m_pool;
+    size_t m_pool_size;
+};
+
+};  // namespace PyZy
+
+#endif  // __PYZY_MAPPED_DICTIONARY_H_
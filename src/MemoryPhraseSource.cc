@@ -0,0 +1,231 @@
+/* vim:set et ts=4 sts=4:
+ *
+ * libpyzy - The Chinese PinYin and Bopomofo conversion library.
+ *
+ * Copyright (c) 2008-2010 Peng Huang <shawn.p.huang@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#include "MemoryPhraseSource.h"
+
+#include <algorithm>
+#include <cstring>
+#include <set>
+
+#include "Database.h"
+#include "PinyinArray.h"
+#include "PinyinOption.h"
+
+namespace PyZy {
+
+/* The candidates of a span, which are all found by the lookup. */
+class MemoryResult : public PhraseResult {
+public:
+    MemoryResult (PhraseArray & phrases) { m_phrases.swap (phrases); }
+
+    void fetch (size_t count)                   { }
+    const PhraseArray & phrases (void) const    { return m_phrases; }
+
+private:
+    PhraseArray m_phrases;
+};
+
+/* Checks whether a goes before b among the candidates of a length, in
+ * the order of the query statements: user_freq, freq, the text. */
+static bool
+candidate_before (const Phrase & a, const Phrase & b)
+{
+    if (a.user_freq != b.user_freq)
+        return a.user_freq > b.user_freq;
+    if (a.freq != b.freq)
+        return a.freq > b.freq;
+    return std::strcmp (a.phrase, b.phrase) < 0;
+}
+
+static bool
+matches (const Phrase & phrase, const PinyinMask *masks)
+{
+    for (size_t i = 0; i < phrase.len; i++) {
+        if (!masks[i].check (phrase.pinyin_id[i].sheng, phrase.pinyin_id[i].yun))
+            return false;
+    }
+    return true;
+}
+
+MemoryPhraseSource::MemoryPhraseSource (void)
+    : m_loaded (false)
+    , m_user_generation (0)
+{
+}
+
+PhraseResultPtr
+MemoryPhraseSource::lookup (const PinyinArray &pinyin,
+                            size_t             pinyin_begin,
+                            size_t             pinyin_len,
+                            unsigned int       option)
+{
+    PhraseArray phrases;
+
+    load ();
+    if (pinyin_len == 0)
+        return PhraseResultPtr (new MemoryResult (phrases));
+
+    pinyin_len = MIN (pinyin_len, MAX_PHRASE_LEN);
+    const PinyinOptionTable & table = PinyinOptionTable::get (option);
+    PinyinMask masks[MAX_PHRASE_LEN];
+    for (size_t i = 0; i < pinyin_len; i++)
+        masks[i] = table.mask (pinyin[pinyin_begin + i]);
+
+    /* the buckets of the shengs the first syllable accepts */
+    size_t buckets[3];
+    size_t nbuckets = 0;
+    for (guint64 shengs = masks[0].sheng; shengs != 0; shengs &= shengs - 1) {
+        size_t bucket = __builtin_ctzll (shengs) % MEMORY_SOURCE_BUCKETS;
+        if (std::find (buckets, buckets + nbuckets, bucket) == buckets + nbuckets)
+            buckets[nbuckets++] = bucket;
+    }
+
+    PhraseArray matched;
+    std::set<std::string> seen;
+    for (size_t len = pinyin_len; len > 0; len--) {
+        /* the user phrases go first when they tie, so a phrase in both
+         * databases is a candidate with its user_freq */
+        matched.clear ();
+        for (size_t i = 0; i < nbuckets; i++) {
+            const PhraseArray & bucket = m_user[len - 1][buckets[i]];
+            for (size_t j = 0; j < bucket.size (); j++) {
+                if (matches (bucket[j], masks))
+                    matched.push_back (bucket[j]);
+            }
+        }
+        for (size_t i = 0; i < nbuckets; i++) {
+            const PhraseArray & bucket = m_main[len - 1][buckets[i]];
+            for (size_t j = 0; j < bucket.size (); j++) {
+                if (matches (bucket[j], masks))
+                    matched.push_back (bucket[j]);
+            }
+        }
+        std::stable_sort (matched.begin (), matched.end (), candidate_before);
+
+        seen.clear ();
+        for (size_t i = 0; i < matched.size (); i++) {
+            if (seen.insert (matched[i].phrase).second)
+                phrases.push_back (matched[i]);
+        }
+    }
+
+    return PhraseResultPtr (new MemoryResult (phrases));
+}
+
+void
+MemoryPhraseSource::commit (const PhraseArray & phrases)
+{
+    Phrase phrase = {""};
+
+    load ();
+    for (size_t i = 0; i < phrases.size (); i++) {
+        phrase += phrases[i];
+        learn (phrases[i]);
+    }
+    if (phrases.size () > 1)
+        learn (phrase);
+
+    Database::instance ().commit (phrases);
+}
+
+void
+MemoryPhraseSource::remove (const Phrase & phrase)
+{
+    load ();
+
+    PhraseArray & phrases = bucket (m_user, phrase);
+    PhraseArray::iterator it = find (phrases, phrase);
+    if (it != phrases.end ())
+        phrases.erase (it);
+
+    Database::instance ().remove (phrase);
+}
+
+void
+MemoryPhraseSource::flush (void)
+{
+    Database::instance ().flush ();
+}
+
+/* Reads the phrases at the first use. The user phrases are read again
+ * when the Database wrote or deleted them in bulk, by an import, a
+ * training or compaction. */
+void
+MemoryPhraseSource::load (void)
+{
+    Database & db = Database::instance ();
+    if (G_LIKELY (m_loaded && m_user_generation == db.userGeneration ()))
+        return;
+
+    PhraseArray phrases;
+    if (!m_loaded) {
+        db.allPhrases (false, phrases);
+        add (m_main, phrases);
+        m_loaded = true;
+    }
+
+    for (size_t i = 0; i < MAX_PHRASE_LEN; i++) {
+        for (size_t j = 0; j < MEMORY_SOURCE_BUCKETS; j++)
+            m_user[i][j].clear ();
+    }
+    phrases.clear ();
+    db.allPhrases (true, phrases);
+    add (m_user, phrases);
+    m_user_generation = db.userGeneration ();
+}
+
+/* Adds one to the user_freq of a phrase, as Database::commit does. */
+void
+MemoryPhraseSource::learn (const Phrase & phrase)
+{
+    PhraseArray & phrases = bucket (m_user, phrase);
+    PhraseArray::iterator it = find (phrases, phrase);
+
+    if (it == phrases.end ()) {
+        phrases.push_back (phrase);
+        phrases.back ().user_freq = 0;
+        it = phrases.end () - 1;
+    }
+    it->user_freq ++;
+}
+
+void
+MemoryPhraseSource::add (Buckets & buckets, const PhraseArray & phrases)
+{
+    for (size_t i = 0; i < phrases.size (); i++)
+        bucket (buckets, phrases[i]).push_back (phrases[i]);
+}
+
+PhraseArray::iterator
+MemoryPhraseSource::find (PhraseArray & bucket, const Phrase & phrase)
+{
+    PhraseArray::iterator it;
+    for (it = bucket.begin (); it != bucket.end (); ++it) {
+        if (it->len == phrase.len &&
+            std::memcmp (it->pinyin_id, phrase.pinyin_id,
+                         phrase.len * sizeof (phrase.pinyin_id[0])) == 0 &&
+            std::strcmp (it->phrase, phrase.phrase) == 0)
+            break;
+    }
+    return it;
+}
+
+};  // namespace PyZy
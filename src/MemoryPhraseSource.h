@@ -0,0 +1,70 @@
+/* vim:set et ts=4 sts=4:
+ *
+ * libpyzy - The Chinese PinYin and Bopomofo conversion library.
+ *
+ * Copyright (c) 2008-2010 Peng Huang <shawn.p.huang@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#ifndef __PYZY_MEMORY_PHRASE_SOURCE_H_
+#define __PYZY_MEMORY_PHRASE_SOURCE_H_
+
+#include "PhraseSource.h"
+
+namespace PyZy {
+
+#define MEMORY_SOURCE_BUCKETS (64)
+
+/* Every phrase of the main and the user database, in memory. They are
+ * read from the Database at the first use, and the user phrases again
+ * after it changed them in bulk. The phrases are bucketed by the length
+ * and the sheng of the first syllable. A lookup scans the buckets of the
+ * first syllable, and sorts the matches. The learned phrases are updated
+ * here, and also committed to the Database. */
+class MemoryPhraseSource : public PhraseSource {
+public:
+    MemoryPhraseSource (void);
+
+    PhraseResultPtr lookup (const PinyinArray   & pinyin,
+                            size_t                pinyin_begin,
+                            size_t                pinyin_len,
+                            unsigned int          option);
+    void commit (const PhraseArray & phrases);
+    void remove (const Phrase & phrase);
+    void flush (void);
+
+private:
+    typedef PhraseArray Buckets[MAX_PHRASE_LEN][MEMORY_SOURCE_BUCKETS];
+
+    void load (void);
+    void learn (const Phrase & phrase);
+    static void add (Buckets & buckets, const PhraseArray & phrases);
+    static PhraseArray & bucket (Buckets & buckets, const Phrase & phrase)
+    {
+        return buckets[phrase.len - 1][phrase.pinyin_id[0].sheng % MEMORY_SOURCE_BUCKETS];
+    }
+    static PhraseArray::iterator find (PhraseArray & bucket, const Phrase & phrase);
+
+private:
+    bool m_loaded;
+    unsigned int m_user_generation;     /* of the Database, when loaded */
+    Buckets m_main;
+    Buckets m_user;
+};
+
+};  // namespace PyZy
+
+#endif  // __PYZY_MEMORY_PHRASE_SOURCE_H_
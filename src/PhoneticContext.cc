@@ -296,6 +296,8 @@ PhoneticContext::getProperty (PropertyName name) const
         return Variant::fromBool (m_config.specialPhrases);
     case PROPERTY_MODE_SIMP:
         return Variant::fromBool (m_config.modeSimp);
+    case PROPERTY_BEAM_WIDTH:
+        return Variant::fromUnsignedInt (m_config.beamWidth);
     default:
         return Variant::nullVariant ();
     }
@@ -311,6 +313,9 @@ PhoneticContext::setProperty (PropertyName name, const Variant &variant)
         case PROPERTY_CONVERSION_OPTION:
             m_config.option = value;
             return true;
+        case PROPERTY_BEAM_WIDTH:
+            m_config.beamWidth = value;
+            return true;
         default:
             return false;
         }
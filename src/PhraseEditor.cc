@@ -21,8 +21,11 @@
  */
 #include "PhraseEditor.h"
 
+#include <cmath>
+
 #include "Config.h"
 #include "Database.h"
+#include "PhraseSource.h"
 #include "SimpTradConverter.h"
 
 namespace PyZy {
@@ -61,7 +64,7 @@ PhraseEditor::update (const PinyinArray &pinyin)
 bool
 PhraseEditor::resetCandidate (size_t i)
 {
-    Database::instance ().remove (m_candidates[i]);
+    PhraseSource::instance ().remove (m_candidates[i]);
 
     updateCandidates ();
     return true;
@@ -70,7 +73,7 @@ PhraseEditor::resetCandidate (size_t i)
 void
 PhraseEditor::commit (void)
 {
-    Database::instance ().commit (m_selected_phrases);
+    PhraseSource::instance ().commit (m_selected_phrases);
     reset ();
 }
 
@@ -128,30 +131,95 @@ PhraseEditor::updateCandidates (void)
     fillCandidates ();
 }
 
+/* The best path to a position of the lattice. A phrase scores the log of
+ * its probability as a unigram, freq over the total freq of the main
+ * phrases, and a learned phrase also gains the log of 1 + user_freq. The
+ * score of a path is the sum of its phrases, so every phrase it is split
+ * into costs the log of the total. Fewer phrases break the ties. */
+struct LatticePath {
+    size_t phrases;
+    double score;
+    size_t prev;                /* position where the last phrase begins */
+    Phrase phrase;              /* the last phrase */
+
+    bool reached (void) const { return phrases != 0; }
+
+    bool operator < (const LatticePath & p) const
+    {
+        if (score != p.score)
+            return score < p.score;
+        return phrases > p.phrases;
+    }
+};
+
 void
 PhraseEditor::updateTheFirstCandidate (void)
 {
-    size_t begin;
-    size_t end;
-
     m_candidate_0_phrases.clear ();
 
     if (G_UNLIKELY (m_pinyin.size () == 0))
         return;
 
-    begin = m_cursor;
-    end = m_pinyin.size ();
-
-    while (begin != end) {
-        int ret;
-        Query query (m_pinyin,
-                     begin,
-                     end - begin,
-                     m_config.option);
-        ret = query.fill (m_candidate_0_phrases, 1);
-        g_assert (ret == 1);
-        begin += m_candidate_0_phrases.back ().len;
+    /* paths[i] is the best path covering the pinyins from m_cursor to
+     * m_cursor + i; every reached position is expanded by the best phrase
+     * of each length, taken from one query of the rest of the pinyins. */
+    size_t n = m_pinyin.size () - m_cursor;
+    LatticePath paths[MAX_PHRASE_LEN + 1];
+    PhraseArray phrases;
+    phrases.reserve (FILL_GRAN);
+
+    for (size_t i = 0; i <= n; i++)
+        paths[i].phrases = 0;
+    paths[0].score = 0;
+    double cost = std::log ((double) MAX (Database::instance ().freqTotal (), 1));
+
+    for (size_t begin = 0; begin < n; begin++) {
+        if (begin != 0 && !paths[begin].reached ())
+            continue;
+
+        /* rows come longest first, and the first row of each length is the
+         * best one. The beam width bounds how many lengths are tried. */
+        Query query (m_pinyin, m_cursor + begin, n - begin, m_config.option);
+        size_t lengths = 0;
+        size_t last_len = 0;
+        bool done = false;
+
+        while (!done) {
+            phrases.clear ();
+            int ret = query.fill (phrases, FILL_GRAN);
+
+            for (size_t i = 0; i < (size_t) ret && !done; i++) {
+                const Phrase & phrase = phrases[i];
+                if (phrase.len == last_len)
+                    continue;
+                last_len = phrase.len;
+
+                LatticePath path = paths[begin];
+                path.phrases ++;
+                path.score += std::log1p ((double) phrase.freq) +
+                              std::log1p ((double) phrase.user_freq) - cost;
+                path.prev = begin;
+                path.phrase = phrase;
+
+                if (!paths[begin + phrase.len].reached () ||
+                    paths[begin + phrase.len] < path)
+                    paths[begin + phrase.len] = path;
+
+                lengths ++;
+                if (m_config.beamWidth != 0 && lengths == m_config.beamWidth)
+                    done = true;
+            }
+
+            if (ret < FILL_GRAN)
+                done = true;
+        }
+
+        g_assert (lengths > 0);
     }
+
+    for (size_t end = n; end != 0; end = paths[end].prev)
+        m_candidate_0_phrases.insert (m_candidate_0_phrases.begin (),
+                                      paths[end].phrase);
 }
 
 bool
@@ -0,0 +1,60 @@
+/* vim:set et ts=4 sts=4:
+ *
+ * libpyzy - The Chinese PinYin and Bopomofo conversion library.
+ *
+ * Copyright (c) 2008-2010 Peng Huang <shawn.p.huang@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#include "PhraseSource.h"
+
+#include "Const.h"
+#include "Database.h"
+#include "MemoryPhraseSource.h"
+
+namespace PyZy {
+
+std::unique_ptr<PhraseSource> PhraseSource::m_instance;
+
+void
+PhraseSource::init (const std::string & user_data_dir, unsigned int flags)
+{
+    /* every backend reads the dictionaries with the Database, and writes
+     * the learned phrases to it */
+    Database::init (user_data_dir, flags);
+
+    if (m_instance.get () == NULL &&
+        (flags & INIT_BACKEND_MASK) == INIT_BACKEND_MEMORY) {
+        m_instance.reset (new MemoryPhraseSource ());
+    }
+}
+
+void
+PhraseSource::finalize (void)
+{
+    m_instance.reset (NULL);
+    Database::finalize ();
+}
+
+PhraseSource &
+PhraseSource::instance (void)
+{
+    if (m_instance.get () != NULL)
+        return *m_instance;
+    return Database::instance ();
+}
+
+};  // namespace PyZy
@@ -0,0 +1,80 @@
+/* vim:set et ts=4 sts=4:
+ *
+ * libpyzy - The Chinese PinYin and Bopomofo conversion library.
+ *
+ * Copyright (c) 2008-2010 Peng Huang <shawn.p.huang@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#ifndef __PYZY_PHRASE_SOURCE_H_
+#define __PYZY_PHRASE_SOURCE_H_
+
+#include <string>
+
+#include "PhraseArray.h"
+#include "Util.h"
+
+namespace PyZy {
+
+class PinyinArray;
+
+/* The candidates of a pinyin span, the longest phrases first, then by
+ * user_freq, freq and the text. A phrase of a length is a candidate once. */
+class PhraseResult {
+public:
+    virtual ~PhraseResult (void) { }
+
+    /* Fetches candidates until there are count of them, or no more. */
+    virtual void fetch (size_t count) = 0;
+    virtual const PhraseArray & phrases (void) const = 0;
+};
+
+typedef std::shared_ptr<PhraseResult> PhraseResultPtr;
+
+/* Where the phrases are looked up, and the learned phrases go. There are
+ * two implementations, chosen by the INIT_BACKEND_* flags of
+ * InputContext::init. The Database serves the sqlite and the mapped
+ * backends; they differ only in whether it reads the main phrases from
+ * the compiled dictionary. A MemoryPhraseSource is a copy of the phrases
+ * of the Database, which still stores the learned phrases. Every backend
+ * returns the same candidates. */
+class PhraseSource {
+public:
+    virtual ~PhraseSource (void) { }
+
+    virtual PhraseResultPtr lookup (const PinyinArray   & pinyin,
+                                    size_t                pinyin_begin,
+                                    size_t                pinyin_len,
+                                    unsigned int          option) = 0;
+    /* Learns the phrases, and the phrase they make up. */
+    virtual void commit (const PhraseArray & phrases) = 0;
+    /* Forgets a learned phrase. */
+    virtual void remove (const Phrase & phrase) = 0;
+    /* Writes the learned phrases which are not written yet. */
+    virtual void flush (void) = 0;
+
+    static void init (const std::string & user_data_dir, unsigned int flags);
+    static void finalize (void);
+    static PhraseSource & instance (void);
+
+private:
+    /* the backend, unless it is the Database */
+    static std::unique_ptr<PhraseSource> m_instance;
+};
+
+};  // namespace PyZy
+
+#endif  // __PYZY_PHRASE_SOURCE_H_
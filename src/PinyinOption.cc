@@ -0,0 +1,55 @@
+/* vim:set et ts=4 sts=4:
+ *
+ * libpyzy - The Chinese PinYin and Bopomofo conversion library.
+ *
+ * Copyright (c) 2008-2010 Peng Huang <shawn.p.huang@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#include "PinyinOption.h"
+
+#include <map>
+
+namespace PyZy {
+
+PinyinOptionTable::PinyinOptionTable (unsigned int option)
+{
+    for (unsigned int id = 0; id < 64; id++) {
+        m_sheng[id] = 0;
+        m_yun[id] = 0;
+        for (unsigned int fid = 0; fid < 64; fid++) {
+            if (pinyin_option_check_sheng (option, id, fid))
+                m_sheng[id] |= PINYIN_ID_BIT (fid);
+            if (pinyin_option_check_yun (option, id, fid))
+                m_yun[id] |= PINYIN_ID_BIT (fid);
+        }
+    }
+}
+
+const PinyinOptionTable &
+PinyinOptionTable::get (unsigned int option)
+{
+    /* only the fuzzy options change the table, and few of them are used */
+    static std::map<unsigned int, PinyinOptionTable> tables;
+
+    option &= PINYIN_FUZZY_ALL;
+    std::map<unsigned int, PinyinOptionTable>::iterator it = tables.find (option);
+    if (it == tables.end ())
+        it = tables.insert (std::make_pair (option, PinyinOptionTable (option))).first;
+    return it->second;
+}
+
+};  // namespace PyZy
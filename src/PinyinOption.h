@@ -0,0 +1,148 @@
+/* vim:set et ts=4 sts=4:
+ *
+ * libpyzy - The Chinese PinYin and Bopomofo conversion library.
+ *
+ * Copyright (c) 2008-2010 Peng Huang <shawn.p.huang@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#ifndef __PYZY_PINYIN_OPTION_H_
+#define __PYZY_PINYIN_OPTION_H_
+
+#include <glib.h>
+
+#include "Const.h"
+#include "Types.h"
+
+namespace PyZy {
+
+/* Checks whether the option accepts the fuzzy sheng fid for the sheng id. */
+static inline bool
+pinyin_option_check_sheng (unsigned int option, unsigned int id, unsigned int fid)
+{
+    switch ((id << 16) | fid) {
+    case (PINYIN_ID_C << 16) | PINYIN_ID_CH:
+        return (option & PINYIN_FUZZY_C_CH);
+    case (PINYIN_ID_CH << 16) | PINYIN_ID_C:
+        return (option & PINYIN_FUZZY_CH_C);
+    case (PINYIN_ID_Z << 16) | PINYIN_ID_ZH:
+        return (option & PINYIN_FUZZY_Z_ZH);
+    case (PINYIN_ID_ZH << 16) | PINYIN_ID_Z:
+        return (option & PINYIN_FUZZY_ZH_Z);
+    case (PINYIN_ID_S << 16) | PINYIN_ID_SH:
+        return (option & PINYIN_FUZZY_S_SH);
+    case (PINYIN_ID_SH << 16) | PINYIN_ID_S:
+        return (option & PINYIN_FUZZY_SH_S);
+    case (PINYIN_ID_L << 16) | PINYIN_ID_N:
+        return (option & PINYIN_FUZZY_L_N);
+    case (PINYIN_ID_N << 16) | PINYIN_ID_L:
+        return (option & PINYIN_FUZZY_N_L);
+    case (PINYIN_ID_F << 16) | PINYIN_ID_H:
+        return (option & PINYIN_FUZZY_F_H);
+    case (PINYIN_ID_H << 16) | PINYIN_ID_F:
+        return (option & PINYIN_FUZZY_H_F);
+    case (PINYIN_ID_L << 16) | PINYIN_ID_R:
+        return (option & PINYIN_FUZZY_L_R);
+    case (PINYIN_ID_R << 16) | PINYIN_ID_L:
+        return (option & PINYIN_FUZZY_R_L);
+    case (PINYIN_ID_K << 16) | PINYIN_ID_G:
+        return (option & PINYIN_FUZZY_K_G);
+    case (PINYIN_ID_G << 16) | PINYIN_ID_K:
+        return (option & PINYIN_FUZZY_G_K);
+    default: return false;
+    }
+}
+
+/* Checks whether the option accepts the fuzzy yun fid for the yun id. */
+static inline bool
+pinyin_option_check_yun (unsigned int option, unsigned int id, unsigned int fid)
+{
+    switch ((id << 16) | fid) {
+    case (PINYIN_ID_AN << 16) | PINYIN_ID_ANG:
+        return (option & PINYIN_FUZZY_AN_ANG);
+    case (PINYIN_ID_ANG << 16) | PINYIN_ID_AN:
+        return (option & PINYIN_FUZZY_ANG_AN);
+    case (PINYIN_ID_EN << 16) | PINYIN_ID_ENG:
+        return (option & PINYIN_FUZZY_EN_ENG);
+    case (PINYIN_ID_ENG << 16) | PINYIN_ID_EN:
+        return (option & PINYIN_FUZZY_ENG_EN);
+    case (PINYIN_ID_IN << 16) | PINYIN_ID_ING:
+        return (option & PINYIN_FUZZY_IN_ING);
+    case (PINYIN_ID_ING << 16) | PINYIN_ID_IN:
+        return (option & PINYIN_FUZZY_ING_IN);
+    case (PINYIN_ID_IAN << 16) | PINYIN_ID_IANG:
+        return (option & PINYIN_FUZZY_IAN_IANG);
+    case (PINYIN_ID_IANG << 16) | PINYIN_ID_IAN:
+        return (option & PINYIN_FUZZY_IANG_IAN);
+    case (PINYIN_ID_UAN << 16) | PINYIN_ID_UANG:
+        return (option & PINYIN_FUZZY_UAN_UANG);
+    case (PINYIN_ID_UANG << 16) | PINYIN_ID_UAN:
+        return (option & PINYIN_FUZZY_UANG_UAN);
+    default: return false;
+    }
+}
+
+/* The bit of a sheng or yun id in a set of ids. */
+#define PINYIN_ID_BIT(id)   ((id) < 64 ? G_GUINT64_CONSTANT (1) << (id) : G_GUINT64_CONSTANT (0))
+
+/* The sheng and yun ids which a pinyin accepts in a syllable of a
+ * phrase, one bit per id, so a syllable is checked with two tests. */
+struct PinyinMask {
+    guint64 sheng;
+    guint64 yun;
+
+    bool check (unsigned int sheng_id, unsigned int yun_id) const {
+        return (sheng & PINYIN_ID_BIT (sheng_id)) && (yun & PINYIN_ID_BIT (yun_id));
+    }
+};
+
+/* The fuzzy ids which every sheng and yun id accepts with an option.
+ * Corrections are made by the parser, which gives the corrected ids, so
+ * they need no entry here. */
+class PinyinOptionTable {
+public:
+    /* Returns the table of the option, which is built on the first use. */
+    static const PinyinOptionTable & get (unsigned int option);
+
+    guint64 sheng (unsigned int id) const   { return id < 64 ? m_sheng[id] : 0; }
+    guint64 yun (unsigned int id) const     { return id < 64 ? m_yun[id] : 0; }
+
+    /* Returns the mask of the pinyin: the fuzzy ids it lists which the
+     * option accepts, and every yun if the pinyin is incomplete. */
+    PinyinMask mask (const Pinyin *p) const {
+        PinyinMask m;
+        m.sheng = PINYIN_ID_BIT (p->pinyin_id[0].sheng) |
+                  (sheng (p->pinyin_id[0].sheng) &
+                   (PINYIN_ID_BIT (p->pinyin_id[1].sheng) |
+                    PINYIN_ID_BIT (p->pinyin_id[2].sheng)));
+        if (p->pinyin_id[0].yun == PINYIN_ID_ZERO)
+            m.yun = ~G_GUINT64_CONSTANT (0);
+        else
+            m.yun = PINYIN_ID_BIT (p->pinyin_id[0].yun) |
+                    (yun (p->pinyin_id[0].yun) & PINYIN_ID_BIT (p->pinyin_id[1].yun));
+        return m;
+    }
+
+private:
+    explicit PinyinOptionTable (unsigned int option);
+
+    guint64 m_sheng[64];
+    guint64 m_yun[64];
+};
+
+};  // namespace PyZy
+
+#endif  // __PYZY_PINYIN_OPTION_H_
@@ -0,0 +1,86 @@
+/* vim:set et ts=4 sts=4:
+ *
+ * libpyzy - The Chinese PinYin and Bopomofo conversion library.
+ *
+ * Copyright (c) 2008-2010 Peng Huang <shawn.p.huang@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#ifndef __PYZY_QUERY_STATS_H_
+#define __PYZY_QUERY_STATS_H_
+
+#include <glib.h>
+#include <cstring>
+#include <string>
+
+namespace PyZy {
+
+#define QUERY_STATS_BUCKETS (24)
+
+/* What the executions of the query statements of one shape cost. An
+ * execution runs from a reset of the statement to the next one, and its
+ * time is spent in sqlite3_step. The histogram counts the executions by
+ * that time: bucket 0 is below 1 us, bucket i from 2^(i-1) us to 2^i us,
+ * and the last one is anything longer. */
+struct QueryStats {
+    std::string example;            /* the pinyin of the first query */
+    unsigned long prepares;         /* statements prepared */
+    guint64 prepare_ns;
+    unsigned long executions;
+    unsigned long steps;
+    unsigned long rows;
+    unsigned long fullscan_steps;   /* SQLITE_STMTSTATUS_FULLSCAN_STEP */
+    unsigned long sorts;            /* SQLITE_STMTSTATUS_SORT */
+    unsigned long autoindexes;      /* SQLITE_STMTSTATUS_AUTOINDEX */
+    guint64 step_ns;
+    unsigned long histogram[QUERY_STATS_BUCKETS];
+
+    QueryStats (void)
+        : prepares (0), prepare_ns (0), executions (0), steps (0), rows (0),
+          fullscan_steps (0), sorts (0), autoindexes (0), step_ns (0)
+    {
+        std::memset (histogram, 0, sizeof (histogram));
+    }
+
+    void addExecution (guint64 ns)
+    {
+        size_t bucket = 0;
+        for (guint64 us = ns / 1000; us > 0 && bucket + 1 < QUERY_STATS_BUCKETS; us >>= 1)
+            bucket ++;
+
+        executions ++;
+        step_ns += ns;
+        histogram[bucket] ++;
+    }
+
+    /* The upper bound in us of the bucket of the p-th percentile, or
+     * G_MAXUINT64 if it is in the last bucket. */
+    guint64 percentile (double p) const
+    {
+        unsigned long rank = (unsigned long) (executions * p / 100);
+        unsigned long count = 0;
+        for (size_t i = 0; i + 1 < QUERY_STATS_BUCKETS; i++) {
+            count += histogram[i];
+            if (count > rank)
+                return (guint64) 1 << i;
+        }
+        return G_MAXUINT64;
+    }
+};
+
+};  // namespace PyZy
+
+#endif  // __PYZY_QUERY_STATS_H_
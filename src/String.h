@@ -37,6 +37,7 @@ public:
     String (const std::string &str) : std::string (str) { }
     String (size_t len) : std::string () { reserve (len); }
 
+    G_GNUC_PRINTF (2, 3)
     String & printf (const char *fmt, ...)
     {
         char *str;
@@ -51,6 +52,7 @@ public:
         return *this;
     }
 
+    G_GNUC_PRINTF (2, 3)
     String & appendPrintf (const char *fmt, ...)
     {
         char *str;
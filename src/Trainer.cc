@@ -0,0 +1,236 @@
+/* vim:set et ts=4 sts=4:
+ *
+ * libpyzy - The Chinese PinYin and Bopomofo conversion library.
+ *
+ * Copyright (c) 2008-2010 Peng Huang <shawn.p.huang@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#include "Trainer.h"
+
+#include <cstring>
+
+#include "Database.h"
+
+namespace PyZy {
+
+/* the smallest piece of a text which is worth a thread */
+#define TRAINER_MIN_PIECE   (64 * 1024)
+
+Trainer::Trainer (unsigned int threads)
+    : m_threads (threads)
+    , m_index (g_hash_table_new (g_str_hash, g_str_equal))
+    , m_max_len (0)
+{
+    if (m_threads == 0) {
+#if GLIB_CHECK_VERSION (2, 36, 0)
+        m_threads = g_get_num_processors ();
+#else
+        m_threads = 1;
+#endif
+    }
+
+    Database::instance ().mainPhrases (m_phrases);
+    m_counts.assign (m_phrases.size (), 0);
+
+    /* the keys are the texts in m_phrases, which is not changed anymore */
+    for (size_t i = 0; i < m_phrases.size (); i++) {
+        g_hash_table_insert (m_index, m_phrases[i].phrase, GUINT_TO_POINTER (i + 1));
+        m_max_len = MAX (m_max_len, m_phrases[i].len);
+    }
+}
+
+Trainer::~Trainer (void)
+{
+    g_hash_table_destroy (m_index);
+}
+
+bool
+Trainer::count (const std::string & path)
+{
+    GError *error = NULL;
+    GMappedFile *file = g_mapped_file_new (path.c_str (), FALSE, &error);
+    if (file == NULL) {
+        g_warning ("%s", error->message);
+        g_error_free (error);
+        return false;
+    }
+
+    const char *text = g_mapped_file_get_contents (file);
+    size_t size = g_mapped_file_get_length (file);
+
+    /* an empty file is mapped to NULL, and has nothing to count */
+    if (size == 0) {
+#if GLIB_CHECK_VERSION (2, 22, 0)
+        g_mapped_file_unref (file);
+#else
+        g_mapped_file_free (file);
+#endif
+        return true;
+    }
+
+    size_t n = CLAMP (size / TRAINER_MIN_PIECE, 1, m_threads);
+
+    /* every worker takes a piece of the text ending at a new line */
+    std::vector<Worker> workers (n);
+    std::vector<GThread *> threads (n, (GThread *) NULL);
+    const char *begin = text;
+    for (size_t i = 0; i < n; i++) {
+        const char *end = text + size * (i + 1) / n;
+        if (end < begin)
+            end = begin;
+        const char *nl = (const char *) std::memchr (end, '\n', text + size - end);
+        end = (i + 1 == n || nl == NULL) ? text + size : nl + 1;
+
+        workers[i].trainer = this;
+        workers[i].begin = begin;
+        workers[i].end = end;
+        workers[i].counts.assign (m_phrases.size (), 0);
+        begin = end;
+
+        /* the first piece is done by this thread */
+        if (i == 0)
+            continue;
+#if GLIB_CHECK_VERSION (2, 32, 0)
+        threads[i] = g_thread_try_new ("pyzy-trainer", Trainer::workerThread, &workers[i], NULL);
+#else
+        threads[i] = g_thread_create (Trainer::workerThread, &workers[i], TRUE, NULL);
+#endif
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (threads[i] != NULL)
+            g_thread_join (threads[i]);
+        else
+            workerThread (&workers[i]);
+
+        for (size_t j = 0; j < m_counts.size (); j++)
+            m_counts[j] += workers[i].counts[j];
+    }
+
+#if GLIB_CHECK_VERSION (2, 22, 0)
+    g_mapped_file_unref (file);
+#else
+    g_mapped_file_free (file);
+#endif
+    return true;
+}
+
+void
+Trainer::commit (void)
+{
+    PhraseArray phrases;
+
+    for (size_t i = 0; i < m_counts.size (); i++) {
+        if (m_counts[i] == 0)
+            continue;
+        phrases.push_back (m_phrases[i]);
+        phrases.back ().user_freq = m_counts[i];
+        m_counts[i] = 0;
+    }
+    Database::instance ().train (phrases);
+}
+
+gpointer
+Trainer::workerThread (gpointer data)
+{
+    Worker *worker = static_cast<Worker *> (data);
+
+    worker->trainer->segment (worker->begin, worker->end, worker->counts);
+    return NULL;
+}
+
+/* Returns the index + 1 of the phrase of the text, or 0. */
+unsigned int
+Trainer::lookup (const char *begin, const char *end) const
+{
+    char text[PHRASE_LEN_IN_BYTE];
+
+    if ((size_t) (end - begin) >= sizeof (text))
+        return 0;
+    std::memcpy (text, begin, end - begin);
+    text[end - begin] = 0;
+    return GPOINTER_TO_UINT (g_hash_table_lookup (m_index, text));
+}
+
+/* Cuts the text into runs of the characters which are phrases. */
+void
+Trainer::segment (const char *begin, const char *end, std::vector<unsigned int> & counts) const
+{
+    std::vector<const char *> chars;
+    const char *p = begin;
+
+    while (p < end) {
+        gunichar c = g_utf8_get_char_validated (p, end - p);
+        const char *next = (c == (gunichar) -1 || c == (gunichar) -2) ? p + 1 : g_utf8_next_char (p);
+
+        /* no ascii character is a phrase */
+        if (next - p > 1 && lookup (p, next) != 0) {
+            chars.push_back (p);
+        }
+        else if (!chars.empty ()) {
+            chars.push_back (p);
+            segmentRun (chars, counts);
+            chars.clear ();
+        }
+        p = next;
+    }
+
+    if (!chars.empty ()) {
+        chars.push_back (end);
+        segmentRun (chars, counts);
+    }
+}
+
+/* Cuts a run of characters into the fewest phrases, and the most frequent
+ * ones of those, like the candidates are chosen. chars has the start of
+ * every character and the end of the run. */
+void
+Trainer::segmentRun (const std::vector<const char *> & chars, std::vector<unsigned int> & counts) const
+{
+    size_t n = chars.size () - 1;
+    std::vector<size_t> phrases (n + 1, G_MAXSIZE);
+    std::vector<guint64> freqs (n + 1, 0);
+    std::vector<size_t> from (n + 1, 0);
+    std::vector<unsigned int> index (n + 1, 0);
+
+    phrases[0] = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (phrases[i] == G_MAXSIZE)
+            continue;
+        for (size_t len = 1; len <= MIN (m_max_len, n - i); len++) {
+            unsigned int id = lookup (chars[i], chars[i + len]);
+            if (id == 0)
+                continue;
+
+            size_t j = i + len;
+            guint64 freq = freqs[i] + m_phrases[id - 1].freq;
+            if (phrases[i] + 1 < phrases[j] ||
+                (phrases[i] + 1 == phrases[j] && freq > freqs[j])) {
+                phrases[j] = phrases[i] + 1;
+                freqs[j] = freq;
+                from[j] = i;
+                index[j] = id;
+            }
+        }
+    }
+
+    /* every character is a phrase, so the whole run is always cut */
+    for (size_t j = n; j > 0; j = from[j])
+        counts[index[j] - 1] ++;
+}
+
+};  // namespace PyZy
@@ -0,0 +1,70 @@
+/* vim:set et ts=4 sts=4:
+ *
+ * libpyzy - The Chinese PinYin and Bopomofo conversion library.
+ *
+ * Copyright (c) 2008-2010 Peng Huang <shawn.p.huang@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#ifndef __PYZY_TRAINER_H_
+#define __PYZY_TRAINER_H_
+
+#include <glib.h>
+#include <string>
+#include <vector>
+
+#include "PhraseArray.h"
+
+namespace PyZy {
+
+/* Learns the user_freq of the phrases from plain text. The text is cut into
+ * the phrases of the main database by several threads, and the phrases are
+ * counted in memory until they are committed to the user database. */
+class Trainer {
+public:
+    /* threads is the number of workers, 0 for one per processor */
+    explicit Trainer (unsigned int threads);
+    ~Trainer (void);
+
+    /* Counts the phrases of a UTF-8 text file. */
+    bool count (const std::string & path);
+    /* Adds the counted phrases to the user database. */
+    void commit (void);
+
+private:
+    struct Worker {
+        const Trainer *trainer;
+        const char *begin;
+        const char *end;
+        std::vector<unsigned int> counts;
+    };
+    static gpointer workerThread (gpointer data);
+
+    unsigned int lookup (const char *begin, const char *end) const;
+    void segment (const char *begin, const char *end, std::vector<unsigned int> & counts) const;
+    void segmentRun (const std::vector<const char *> & chars, std::vector<unsigned int> & counts) const;
+
+private:
+    unsigned int m_threads;
+    PhraseArray m_phrases;          /* the main phrases */
+    GHashTable *m_index;            /* text of a phrase to its index + 1 */
+    size_t m_max_len;               /* of the main phrases */
+    std::vector<unsigned int> m_counts;
+};
+
+};  // namespace PyZy
+
+#endif  // __PYZY_TRAINER_H_
@@ -0,0 +1,55 @@
+/* vim:set et ts=4 sts=4:
+ *
+ * libpyzy - The Chinese PinYin and Bopomofo conversion library.
+ *
+ * Copyright (c) 2008-2010 Peng Huang <shawn.p.huang@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#include <glib.h>
+#include <cstdio>
+#include <cstring>
+
+#include "MappedDictionary.h"
+
+/* Compiles a main database into the dictionary pyzy maps into memory. The
+ * dictionary must be next to the database, named after it with the suffix
+ * .dict, e.g. android.dict for android.db, and compiled again whenever the
+ * database changes. */
+
+int main (int argc, char **argv)
+{
+    if (argc != 2 && argc != 3) {
+        fprintf (stderr, "Usage: %s SOURCE.db [DEST.dict]\n", argv[0]);
+        return 1;
+    }
+
+    gchar *path;
+    if (argc == 3) {
+        path = g_strdup (argv[2]);
+    }
+    else {
+        const gchar *source = argv[1];
+        size_t len = g_str_has_suffix (source, ".db") ? std::strlen (source) - 3 : std::strlen (source);
+        path = g_strdup_printf ("%.*s.dict", (int) len, source);
+    }
+
+    bool ret = PyZy::MappedDictionary::compile (argv[1], path);
+    if (!ret)
+        fprintf (stderr, "Can not compile %s into %s\n", argv[1], path);
+    g_free (path);
+    return ret ? 0 : 1;
+}
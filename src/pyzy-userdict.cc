@@ -0,0 +1,117 @@
+/* vim:set et ts=4 sts=4:
+ *
+ * libpyzy - The Chinese PinYin and Bopomofo conversion library.
+ *
+ * Copyright (c) 2008-2010 Peng Huang <shawn.p.huang@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <cstdio>
+#include <cstring>
+
+#include "Const.h"
+#include "InputContext.h"
+
+/* Exports the user phrases of pyzy to a text file, or imports them. */
+
+static gchar *user_cache_dir = NULL;
+
+static const GOptionEntry entries[] = {
+    { "user-cache-dir", 'd', 0, G_OPTION_ARG_FILENAME, &user_cache_dir,
+      "Directory of the user dictionary", "DIR" },
+    { NULL }
+};
+
+/* Takes the lock of the user dictionary in dir exclusively, see
+ * USER_DB_LOCK_FILE, and returns its file, or -1 if another process has
+ * it. */
+static int
+lock_user_db (const gchar *dir)
+{
+    g_mkdir_with_parents (dir, 0750);
+    gchar *path = g_build_filename (dir, USER_DB_LOCK_FILE, NULL);
+    int fd = g_open (path, O_RDWR | O_CREAT, 0600);
+    g_free (path);
+    if (fd >= 0 && flock (fd, LOCK_EX | LOCK_NB) != 0) {
+        close (fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+int main (int argc, char **argv)
+{
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new ("export|import FILE...");
+    g_option_context_add_main_entries (context, entries, NULL);
+    g_option_context_set_summary (context,
+        "The user dictionary is changed on disk. It is refused while an input\n"
+        "method of pyzy which keeps the dictionary in memory is running, as\n"
+        "that would write its copy over the changes.");
+
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        fprintf (stderr, "%s\n", error->message);
+        g_error_free (error);
+        return 1;
+    }
+    g_option_context_free (context);
+
+    bool exporting = argc == 3 && std::strcmp (argv[1], "export") == 0;
+    bool importing = argc >= 3 && std::strcmp (argv[1], "import") == 0;
+    if (!exporting && !importing) {
+        fprintf (stderr, "Usage: %s [-d DIR] export FILE\n"
+                         "       %s [-d DIR] import FILE...\n",
+                 g_get_prgname (), g_get_prgname ());
+        return 1;
+    }
+
+    /* the same directories as InputContext::init () */
+    gchar *cache_dir = user_cache_dir != NULL ? g_strdup (user_cache_dir) :
+        g_build_filename (g_get_user_cache_dir (), "pyzy", NULL);
+    gchar *config_dir = user_cache_dir != NULL ? g_strdup (user_cache_dir) :
+        g_build_filename (g_get_user_config_dir (), "pyzy", NULL);
+
+    int lock = lock_user_db (cache_dir);
+    if (lock < 0) {
+        fprintf (stderr, "%s: the user dictionary in %s is in use, "
+                         "quit the input method first\n", argv[0], cache_dir);
+        return 1;
+    }
+    PyZy::InputContext::init (cache_dir, config_dir, INIT_USER_DB_ON_DISK);
+    g_free (cache_dir);
+    g_free (config_dir);
+
+    bool ret = true;
+    if (exporting) {
+        ret = PyZy::InputContext::exportUserPhrases (argv[2]);
+    }
+    else {
+        for (int i = 2; i < argc; i++) {
+            if (!PyZy::InputContext::importUserPhrases (argv[i]))
+                ret = false;
+        }
+    }
+
+    PyZy::InputContext::finalize ();
+    close (lock);
+    g_free (user_cache_dir);
+    return ret ? 0 : 1;
+}
@@ -0,0 +1,417 @@
+/* vim:set et ts=4 sts=4:
+ *
+ * libpyzy - The Chinese PinYin and Bopomofo conversion library.
+ *
+ * Copyright (c) 2008-2010 Peng Huang <shawn.p.huang@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#include <glib/gstdio.h>
+#include <sqlite3.h>
+
+#include <cstdio>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Const.h"
+#include "Database.h"
+#include "InputContext.h"
+#include "PinyinParser.h"
+#include "Util.h"  // for unique_ptr
+#include "Variant.h"
+
+/* Checks that every backend of InputContext::init returns the same
+ * candidates, before and after phrases are learned and forgotten, and
+ * after the user phrases are imported and compacted. */
+
+using namespace std;
+using namespace PyZy;
+
+class DummyObserver : public PyZy::InputContext::Observer {
+public:
+    void commitText (InputContext *context, const std::string &commit_text) {}
+    void inputTextChanged (InputContext *context) {}
+    void preeditTextChanged (InputContext *context) {}
+    void auxiliaryTextChanged (InputContext *context) {}
+    void candidatesChanged (InputContext *context) {}
+    void cursorChanged (InputContext *context) {}
+};
+
+static const struct {
+    unsigned int flags;
+    const char *name;
+} kBackends[] = {
+    { INIT_BACKEND_SQLITE, "sqlite" },
+    { INIT_BACKEND_MAPPED, "mapped" },
+    { INIT_BACKEND_MEMORY, "memory" },
+};
+
+static const char *kInputs[] = {
+    "nihao",
+    "zhongguoren",
+    "zhangshizhi",
+    "shi",
+    "xian",
+    "zgr",
+    "wmzgzdhd",
+    "changan",
+    "lvxing",
+};
+
+static const unsigned int kOptions[] = {
+    0,
+    PINYIN_INCOMPLETE_PINYIN | PINYIN_CORRECT_ALL,
+    PINYIN_INCOMPLETE_PINYIN | PINYIN_CORRECT_ALL | PINYIN_FUZZY_ALL,
+};
+
+/* candidates compared for every input */
+static const size_t kCandidates = 200;
+
+/* The user phrases which are imported, of a large user_freq, so they
+ * move up. */
+static const struct {
+    const char *text;
+    const char *pinyin;
+    unsigned int user_freq;
+} kImported[] = {
+    { "泥号", "ni'hao", 1000 },
+    { "种过人", "zhong'guo'ren", 1000 },
+    { "先", "xian", 500 },
+    { "绿星", "lv'xing", 500 },
+};
+
+/* user phrases which are kept by compaction */
+static const unsigned int kUserLimit = 4;
+
+/* The main databases which Database opens, but main.db. */
+static const char *kMainDatabases[] = {
+    PKGDATADIR"/db/local.db",
+    PKGDATADIR"/db/open-phrase.db",
+    PKGDATADIR"/db/android.db",
+};
+
+/* The phrases of the main database which is made for the test if none is
+ * installed. Most have the same freq, so their text decides the order. */
+static const struct {
+    const char *text;
+    const char *pinyin;
+    unsigned int freq;
+} kFixture[] = {
+    { "是", "shi", 10 }, { "事", "shi", 10 }, { "时", "shi", 10 },
+    { "市", "shi", 10 }, { "十", "shi", 10 }, { "使", "shi", 10 },
+    { "世", "shi", 10 }, { "式", "shi", 10 }, { "四", "si", 10 },
+    { "死", "si", 10 }, { "次", "ci", 10 }, { "字", "zi", 10 },
+    { "之", "zhi", 10 }, { "知", "zhi", 10 }, { "只", "zhi", 10 },
+    { "张", "zhang", 10 }, { "章", "zhang", 10 }, { "脏", "zang", 10 },
+    { "你", "ni", 10 }, { "泥", "ni", 10 }, { "里", "li", 10 },
+    { "好", "hao", 10 }, { "号", "hao", 10 }, { "中", "zhong", 10 },
+    { "种", "zhong", 10 }, { "国", "guo", 10 }, { "过", "guo", 10 },
+    { "人", "ren", 10 }, { "任", "ren", 10 }, { "先", "xian", 10 },
+    { "现", "xian", 10 }, { "想", "xiang", 10 }, { "西", "xi", 10 },
+    { "安", "an", 10 }, { "昂", "ang", 10 }, { "长", "chang", 10 },
+    { "常", "chang", 8 }, { "产", "chan", 8 }, { "绿", "lv", 8 },
+    { "旅", "lv", 8 }, { "行", "xing", 8 }, { "新", "xin", 8 },
+    { "干", "gan", 8 }, { "我", "wo", 8 }, { "们", "men", 8 },
+    { "在", "zai", 8 },
+    { "的", "de", 8 }, { "大", "da", 8 }, { "会", "hui", 8 },
+    { "你好", "ni'hao", 20 }, { "泥号", "ni'hao", 20 },
+    { "中国", "zhong'guo", 20 }, { "种过", "zhong'guo", 20 },
+    { "国人", "guo'ren", 20 }, { "中国人", "zhong'guo'ren", 20 },
+    { "西安", "xi'an", 20 }, { "长安", "chang'an", 20 },
+    { "常安", "chang'an", 20 }, { "旅行", "lv'xing", 20 },
+    { "绿星", "lv'xing", 20 }, { "实质", "shi'zhi", 20 },
+    { "市值", "shi'zhi", 20 }, { "张氏", "zhang'shi", 20 },
+    { "我们", "wo'men", 20 }, { "大会", "da'hui", 20 },
+    { "我们中国", "wo'men'zhong'guo", 20 },
+    { "在大会", "zai'da'hui", 20 },
+};
+
+string getTestDir (const char *name)
+{
+    gchar *dir_name = g_strdup_printf ("__pyzy_backends_%s__", name);
+    gchar *path = g_build_filename (g_get_tmp_dir(), dir_name, NULL);
+    const string result = path;
+    g_free (path);
+    g_free (dir_name);
+    return result;
+}
+
+bool removeDirectory (const string &path) {
+    GDir *dir = g_dir_open (path.c_str (), 0, NULL);
+    if (dir == NULL) {
+        return false;
+    }
+
+    const gchar *entry_name = NULL;
+    while ((entry_name = g_dir_read_name (dir)) != NULL) {
+        gchar *entry_path = g_build_filename (path.c_str (), entry_name, NULL);
+
+        if (g_file_test (entry_path, G_FILE_TEST_IS_DIR)) {
+            removeDirectory (entry_path);
+        } else {
+            g_unlink (entry_path);
+        }
+
+        g_free (entry_path);
+    }
+
+    g_dir_close (dir);
+    int ret = g_rmdir (path.c_str ());
+
+    return ret == 0;
+}
+
+void insertKeys (InputContext *context, const string &keys) {
+    for (size_t i = 0; i < keys.size (); ++i) {
+        context->insert (keys[i]);
+    }
+}
+
+/* Appends the candidates of every input with every option to stream. */
+void readCandidates (InputContext *context, vector<string> &stream)
+{
+    for (size_t i = 0; i < G_N_ELEMENTS (kOptions); i++) {
+        context->setProperty (InputContext::PROPERTY_CONVERSION_OPTION,
+                              Variant::fromUnsignedInt (kOptions[i]));
+        for (size_t j = 0; j < G_N_ELEMENTS (kInputs); j++) {
+            context->reset ();
+            insertKeys (context, kInputs[j]);
+
+            Candidate candidate;
+            for (size_t k = 0; k < kCandidates && context->hasCandidate (k); k++) {
+                context->getCandidate (k, candidate);
+                gchar *line = g_strdup_printf ("%#x %s %d %s", kOptions[i], kInputs[j],
+                                               candidate.type, candidate.text.c_str ());
+                stream.push_back (line);
+                g_free (line);
+            }
+        }
+    }
+    context->reset ();
+}
+
+/* Learns candidate index of every input and of the rest of its text, so
+ * they move up. */
+void learnCandidates (InputContext *context, size_t index)
+{
+    for (size_t j = 0; j < G_N_ELEMENTS (kInputs); j++) {
+        context->reset ();
+        insertKeys (context, kInputs[j]);
+        while (!context->inputText ().empty () && context->hasCandidate (0)) {
+            if (!context->selectCandidate (context->hasCandidate (index) ? index : 0))
+                break;
+        }
+        if (!context->inputText ().empty ())
+            context->commit (InputContext::TYPE_CONVERTED);
+    }
+    context->reset ();
+}
+
+/* Forgets the first learned candidate of every input. */
+void forgetCandidates (InputContext *context)
+{
+    for (size_t j = 0; j < G_N_ELEMENTS (kInputs); j++) {
+        context->reset ();
+        insertKeys (context, kInputs[j]);
+
+        Candidate candidate;
+        for (size_t k = 0; k < kCandidates && context->hasCandidate (k); k++) {
+            context->getCandidate (k, candidate);
+            if (candidate.type == USER_PHRASE) {
+                context->resetCandidate (k);
+                break;
+            }
+        }
+    }
+    context->reset ();
+}
+
+/* Writes the imported phrases in the format of exportUserPhrases. */
+bool writeImported (const string &path)
+{
+    FILE *file = g_fopen (path.c_str (), "w");
+    if (file == NULL)
+        return false;
+
+    fprintf (file, "# pyzy user phrases 1.0\n");
+    for (size_t i = 0; i < G_N_ELEMENTS (kImported); i++) {
+        PinyinArray pinyin;
+        String text (kImported[i].pinyin);
+        PinyinParser::parse (text, text.size (), 0, pinyin, MAX_PHRASE_LEN);
+
+        fprintf (file, "%s\t%u\t1\t0", kImported[i].text, kImported[i].user_freq);
+        for (size_t j = 0; j < pinyin.size (); j++)
+            fprintf (file, "\t%d\t%d", pinyin[j]->pinyin_id[0].sheng, pinyin[j]->pinyin_id[0].yun);
+        fprintf (file, "\n");
+    }
+    return fclose (file) == 0;
+}
+
+/* Makes a main database of the fixture phrases at path. */
+bool createFixture (const char *path)
+{
+    sqlite3 *db = NULL;
+    if (sqlite3_open (path, &db) != SQLITE_OK) {
+        sqlite3_close (db);
+        return false;
+    }
+
+    bool ok = sqlite3_exec (db, "BEGIN TRANSACTION;", NULL, NULL, NULL) == SQLITE_OK;
+    for (size_t i = 0; ok && i < MAX_PHRASE_LEN; i++) {
+        String sql;
+        sql.printf ("CREATE TABLE py_phrase_%d (phrase TEXT, freq INTEGER", (int) i);
+        for (size_t j = 0; j <= i; j++)
+            sql.appendPrintf (", s%d INTEGER, y%d INTEGER", (int) j, (int) j);
+        sql << ");";
+        ok = sqlite3_exec (db, sql.c_str (), NULL, NULL, NULL) == SQLITE_OK;
+    }
+
+    for (size_t i = 0; ok && i < G_N_ELEMENTS (kFixture); i++) {
+        PinyinArray pinyin;
+        String text (kFixture[i].pinyin);
+        PinyinParser::parse (text, text.size (), 0, pinyin, MAX_PHRASE_LEN);
+        if (pinyin.size () != (size_t) g_utf8_strlen (kFixture[i].text, -1)) {
+            ok = false;
+            break;
+        }
+
+        String sql;
+        sql.printf ("INSERT INTO py_phrase_%d VALUES ('%s', %u", (int) pinyin.size () - 1,
+                    kFixture[i].text, kFixture[i].freq);
+        for (size_t j = 0; j < pinyin.size (); j++)
+            sql.appendPrintf (", %d, %d", pinyin[j]->pinyin_id[0].sheng, pinyin[j]->pinyin_id[0].yun);
+        sql << ");";
+        ok = sqlite3_exec (db, sql.c_str (), NULL, NULL, NULL) == SQLITE_OK;
+    }
+
+    /* a rare phrase for every syllable which is typed, as the first
+     * candidate must have a path through the input */
+    std::set<int> syllables;
+    for (size_t i = 0; ok && i < G_N_ELEMENTS (kOptions); i++) {
+        for (size_t j = 0; ok && j < G_N_ELEMENTS (kInputs); j++) {
+            String text (kInputs[j]);
+            for (size_t len = 1; ok && len <= text.size (); len++) {
+                PinyinArray pinyin;
+                PinyinParser::parse (text, len, kOptions[i], pinyin, MAX_PHRASE_LEN);
+                for (size_t k = 0; ok && k < pinyin.size (); k++) {
+                    int sheng = pinyin[k]->pinyin_id[0].sheng;
+                    int yun = pinyin[k]->pinyin_id[0].yun;
+                    if (!syllables.insert ((sheng << 8) | yun).second)
+                        continue;
+
+                    String sql;
+                    sql.printf ("INSERT INTO py_phrase_0 VALUES ('〇', 1, %d, %d);", sheng, yun);
+                    ok = sqlite3_exec (db, sql.c_str (), NULL, NULL, NULL) == SQLITE_OK;
+                }
+            }
+        }
+    }
+
+    ok = ok && sqlite3_exec (db, "COMMIT;", NULL, NULL, NULL) == SQLITE_OK;
+    sqlite3_close (db);
+    if (!ok)
+        g_unlink (path);
+    return ok;
+}
+
+/* The candidates of a backend, from an empty user dictionary. */
+vector<string> run (unsigned int flags, const char *name)
+{
+    const string test_dir = getTestDir (name);
+    removeDirectory (test_dir);
+    InputContext::init (test_dir, test_dir, flags);
+
+    DummyObserver observer;
+    unique_ptr<InputContext> context;
+    context.reset (InputContext::create (InputContext::FULL_PINYIN, &observer));
+
+    vector<string> stream;
+    readCandidates (context.get (), stream);
+    learnCandidates (context.get (), 0);
+
+    /* reopened, the learned phrases are stored, and the next ones are
+     * pending. A pending phrase of a larger text then ties with a stored
+     * one of the same user_freq and freq. */
+    context.reset ();
+    InputContext::finalize ();
+    InputContext::init (test_dir, test_dir, flags);
+    context.reset (InputContext::create (InputContext::FULL_PINYIN, &observer));
+
+    readCandidates (context.get (), stream);
+    learnCandidates (context.get (), 3);
+    readCandidates (context.get (), stream);
+    forgetCandidates (context.get ());
+    readCandidates (context.get (), stream);
+
+    /* the user phrases are changed in bulk, behind the backend */
+    const string imported = test_dir + G_DIR_SEPARATOR_S "imported.txt";
+    g_assert (writeImported (imported));
+    g_assert (InputContext::importUserPhrases (imported));
+    readCandidates (context.get (), stream);
+    InputContext::setUserPhraseLimit (kUserLimit);
+    Database::instance ().compact ();
+    readCandidates (context.get (), stream);
+
+    context.reset ();
+    InputContext::finalize ();
+    removeDirectory (test_dir);
+    return stream;
+}
+
+int main (int argc, char **argv)
+{
+    /* without an installed main database, the test makes main.db in the
+     * current directory, and skips if it can not */
+    bool fixture = true;
+    for (size_t i = 0; i < G_N_ELEMENTS (kMainDatabases); i++) {
+        if (g_file_test (kMainDatabases[i], G_FILE_TEST_IS_REGULAR))
+            fixture = false;
+    }
+    if (g_file_test ("main.db", G_FILE_TEST_EXISTS))
+        fixture = false;
+    if (fixture && !createFixture ("main.db")) {
+        fprintf (stderr, "no main database, and can not make main.db\n");
+        return 77;
+    }
+
+    vector<string> expected = run (kBackends[0].flags, kBackends[0].name);
+    g_assert (!expected.empty ());
+
+    int ret = 0;
+    for (size_t i = 1; i < G_N_ELEMENTS (kBackends); i++) {
+        vector<string> stream = run (kBackends[i].flags, kBackends[i].name);
+
+        size_t n;
+        for (n = 0; n < expected.size () && n < stream.size (); n++) {
+            if (expected[n] != stream[n])
+                break;
+        }
+        if (n == expected.size () && n == stream.size ())
+            continue;
+
+        fprintf (stderr, "%s differs from %s at candidate %lu:\n  %s\n  %s\n",
+                 kBackends[i].name, kBackends[0].name, (unsigned long) n,
+                 n < expected.size () ? expected[n].c_str () : "(none)",
+                 n < stream.size () ? stream[n].c_str () : "(none)");
+        ret = 1;
+    }
+
+    if (fixture) {
+        g_unlink ("main.db");
+    }
+    return ret;
+}
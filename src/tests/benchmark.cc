@@ -0,0 +1,562 @@
+/* vim:set et ts=4 sts=4:
+ *
+ * libpyzy - The Chinese PinYin and Bopomofo conversion library.
+ *
+ * Copyright (c) 2008-2010 Peng Huang <shawn.p.huang@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <sqlite3.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "Const.h"
+#include "Database.h"
+#include "InputContext.h"
+#include "MappedDictionary.h"
+#include "PhraseEditor.h"  // for FILL_GRAN
+#include "PinyinOption.h"
+#include "PinyinParser.h"
+#include "Util.h"  // for unique_ptr
+#include "Variant.h"
+
+
+using namespace std;
+using namespace PyZy;
+
+#define BENCH_ROUNDS (10)
+
+class DummyObserver : public PyZy::InputContext::Observer {
+public:
+    void commitText (InputContext *context, const std::string &commit_text) {}
+    void inputTextChanged (InputContext *context) {}
+    void preeditTextChanged (InputContext *context) {}
+    void auxiliaryTextChanged (InputContext *context) {}
+    void candidatesChanged (InputContext *context) {}
+    void cursorChanged (InputContext *context) {}
+};
+
+static const char *kInputs[] = {
+    "zhangshizhi",
+    "zhongguoren",
+    "shishishenme",
+    "chongqingshizhengfu",
+    "zhonghuarenmingongheguo",
+};
+
+/* Types the keys one by one, and returns the average time of a keystroke in
+ * microseconds. */
+double typeKeys (InputContext *context, const char *keys, size_t rounds)
+{
+    GTimer *timer = g_timer_new ();
+    size_t count = 0;
+
+    for (size_t r = 0; r < rounds; r++) {
+        context->reset ();
+        for (const char *p = keys; *p != 0; p++, count++) {
+            context->insert (*p);
+            context->hasCandidate (0);
+        }
+    }
+
+    double elapsed = g_timer_elapsed (timer, NULL);
+    g_timer_destroy (timer);
+    context->reset ();
+
+    return elapsed * 1000000 / count;
+}
+
+void benchFuzzy ()
+{
+    static const struct {
+        const char *name;
+        unsigned int option;
+    } fuzzy [] = {
+        { "none",       0 },
+        { "c_ch",       PINYIN_FUZZY_C_CH },
+        { "ch_c",       PINYIN_FUZZY_CH_C },
+        { "z_zh",       PINYIN_FUZZY_Z_ZH },
+        { "zh_z",       PINYIN_FUZZY_ZH_Z },
+        { "s_sh",       PINYIN_FUZZY_S_SH },
+        { "sh_s",       PINYIN_FUZZY_SH_S },
+        { "l_n",        PINYIN_FUZZY_L_N },
+        { "n_l",        PINYIN_FUZZY_N_L },
+        { "f_h",        PINYIN_FUZZY_F_H },
+        { "h_f",        PINYIN_FUZZY_H_F },
+        { "l_r",        PINYIN_FUZZY_L_R },
+        { "r_l",        PINYIN_FUZZY_R_L },
+        { "k_g",        PINYIN_FUZZY_K_G },
+        { "g_k",        PINYIN_FUZZY_G_K },
+        { "an_ang",     PINYIN_FUZZY_AN_ANG },
+        { "ang_an",     PINYIN_FUZZY_ANG_AN },
+        { "en_eng",     PINYIN_FUZZY_EN_ENG },
+        { "eng_en",     PINYIN_FUZZY_ENG_EN },
+        { "in_ing",     PINYIN_FUZZY_IN_ING },
+        { "ing_in",     PINYIN_FUZZY_ING_IN },
+        { "all",        PINYIN_FUZZY_ALL },
+    };
+
+    DummyObserver observer;
+    unique_ptr<InputContext> context;
+    context.reset (InputContext::create (InputContext::FULL_PINYIN, &observer));
+
+    printf ("fuzzy option sweep (us per keystroke)\n");
+    printf ("%-8s", "option");
+    for (size_t i = 0; i < G_N_ELEMENTS (kInputs); i++)
+        printf (" %12.12s", kInputs[i]);
+    printf ("\n");
+
+    for (size_t i = 0; i < G_N_ELEMENTS (fuzzy); i++) {
+        unsigned int option = PINYIN_INCOMPLETE_PINYIN | PINYIN_CORRECT_ALL | fuzzy[i].option;
+        context->setProperty (InputContext::PROPERTY_CONVERSION_OPTION,
+                              Variant::fromUnsignedInt (option));
+
+        printf ("%-8s", fuzzy[i].name);
+        for (size_t j = 0; j < G_N_ELEMENTS (kInputs); j++)
+            printf (" %12.1f", typeKeys (context.get (), kInputs[j], BENCH_ROUNDS));
+        printf ("\n");
+    }
+}
+
+void benchBeam ()
+{
+    static const unsigned int beams[] = { 1, 2, 4, 8, 0 };
+
+    DummyObserver observer;
+    unique_ptr<InputContext> context;
+    context.reset (InputContext::create (InputContext::FULL_PINYIN, &observer));
+
+    printf ("beam width sweep (us per keystroke)\n");
+    printf ("%-8s", "beam");
+    for (size_t i = 0; i < G_N_ELEMENTS (kInputs); i++)
+        printf (" %12.12s", kInputs[i]);
+    printf ("\n");
+
+    for (size_t i = 0; i < G_N_ELEMENTS (beams); i++) {
+        context->setProperty (InputContext::PROPERTY_BEAM_WIDTH,
+                              Variant::fromUnsignedInt (beams[i]));
+
+        printf ("%-8u", beams[i]);
+        for (size_t j = 0; j < G_N_ELEMENTS (kInputs); j++)
+            printf (" %12.1f", typeKeys (context.get (), kInputs[j], BENCH_ROUNDS));
+        printf ("\n");
+    }
+}
+
+/* Prints the query statistics of typing every input with all the fuzzy
+ * pinyins. */
+void benchQueryStats ()
+{
+    DummyObserver observer;
+    unique_ptr<InputContext> context;
+    context.reset (InputContext::create (InputContext::FULL_PINYIN, &observer));
+    context->setProperty (InputContext::PROPERTY_CONVERSION_OPTION,
+                          Variant::fromUnsignedInt (PINYIN_INCOMPLETE_PINYIN |
+                                                    PINYIN_CORRECT_ALL |
+                                                    PINYIN_FUZZY_ALL));
+
+    Database::instance ().flushResults ();
+    InputContext::setQueryStats (true);
+    for (size_t i = 0; i < G_N_ELEMENTS (kInputs); i++)
+        typeKeys (context.get (), kInputs[i], 1);
+    InputContext::setQueryStats (false);
+
+    printf ("query statistics\n%s", InputContext::queryStats ().c_str ());
+}
+
+/* Times the first page of candidates, and all of them, of very common
+ * syllables. The cached results are dropped before every round. */
+void benchFirstPage ()
+{
+    static const char *syllables[] = { "shi", "yi", "ji", "zhi", "shishi" };
+    const unsigned int option = PINYIN_INCOMPLETE_PINYIN | PINYIN_CORRECT_ALL;
+
+    printf ("first page latency (us)\n");
+    printf ("%-8s %12s %12s %8s\n", "pinyin", "first page", "all", "rows");
+
+    for (size_t i = 0; i < G_N_ELEMENTS (syllables); i++) {
+        PinyinArray pinyin;
+        String text (syllables[i]);
+        PinyinParser::parse (text, text.size (), option, pinyin, MAX_PHRASE_LEN);
+
+        double first = 0, all = 0;
+        size_t rows = 0;
+        GTimer *timer = g_timer_new ();
+
+        for (size_t r = 0; r < BENCH_ROUNDS; r++) {
+            PhraseArray phrases;
+            Database::instance ().flushResults ();
+            Query query (pinyin, 0, pinyin.size (), option);
+
+            g_timer_start (timer);
+            query.fill (phrases, FILL_GRAN);
+            first += g_timer_elapsed (timer, NULL);
+            while (query.fill (phrases, FILL_GRAN) == FILL_GRAN);
+            all += g_timer_elapsed (timer, NULL);
+            rows = phrases.size ();
+        }
+        g_timer_destroy (timer);
+
+        printf ("%-8s %12.1f %12.1f %8zu\n", syllables[i],
+                first * 1000000 / BENCH_ROUNDS, all * 1000000 / BENCH_ROUNDS, rows);
+    }
+}
+
+/* Times the lookups of long abbreviations, which only have the initials,
+ * with every scan kernel of the compiled dictionary. Past the leading
+ * syllable the rows are scanned, so this is where the kernels differ. The
+ * dictionary is looked up directly, every length of the input, as the
+ * other backends do not use it. */
+void benchAbbreviation ()
+{
+    static const char *kernels[] = { "scalar", "sse2", "avx2" };
+    static const char *inputs[] = {
+        "zhrmghg", "zgrmjfj", "bjdxjsjkx", "wmdzgddhxz", "zhzhzhzhzh",
+    };
+    const unsigned int option = PINYIN_INCOMPLETE_PINYIN | PINYIN_CORRECT_ALL;
+
+    const MappedDictionary & dict = Database::instance ().dict ();
+    if (!dict.opened ()) {
+        printf ("long abbreviations: no compiled dictionary, run with --mapped\n");
+        return;
+    }
+
+    printf ("long abbreviations (us per lookup of every length)\n");
+    printf ("%-8s", "kernel");
+    for (size_t i = 0; i < G_N_ELEMENTS (inputs); i++)
+        printf (" %12.12s", inputs[i]);
+    printf ("\n");
+
+    for (size_t k = 0; k < G_N_ELEMENTS (kernels); k++) {
+        if (!MappedDictionary::setScanKernel (kernels[k]))
+            continue;
+
+        printf ("%-8s", kernels[k]);
+        for (size_t i = 0; i < G_N_ELEMENTS (inputs); i++) {
+            PinyinArray pinyin;
+            String text (inputs[i]);
+            PinyinParser::parse (text, text.size (), option, pinyin, MAX_PHRASE_LEN);
+
+            /* the sheng of every syllable, with any yun unless it has one */
+            MappedDictionary::Syllable syllables[MAX_PHRASE_LEN];
+            for (size_t j = 0; j < pinyin.size (); j++) {
+                MappedDictionary::Syllable & s = syllables[j];
+                s.nsheng = 1;
+                s.shengs[0] = pinyin[j]->pinyin_id[0].sheng;
+                s.nyun = 0;
+                if (pinyin[j]->pinyin_id[0].yun != 0)
+                    s.yuns[s.nyun++] = pinyin[j]->pinyin_id[0].yun;
+                s.mask.sheng = PINYIN_ID_BIT (s.shengs[0]);
+                s.mask.yun = s.nyun == 0 ? ~G_GUINT64_CONSTANT (0) : PINYIN_ID_BIT (s.yuns[0]);
+            }
+
+            GTimer *timer = g_timer_new ();
+            for (size_t r = 0; r < BENCH_ROUNDS; r++) {
+                PhraseArray phrases;
+                for (size_t len = pinyin.size (); len > 0; len--)
+                    dict.lookup (syllables, len, phrases);
+            }
+            printf (" %12.1f", g_timer_elapsed (timer, NULL) * 1000000 / BENCH_ROUNDS);
+            g_timer_destroy (timer);
+        }
+        printf ("\n");
+    }
+    MappedDictionary::setScanKernel (NULL);
+}
+
+/* Times committing a sentence of 5 phrases to the user database, with the
+ * pending updates written by every commit, and buffered. */
+/* Writes the sentence rounds times to a private database with the tables
+ * of the user database, in a transaction per sentence. With text, the
+ * statements are built as text with the phrase pasted in, as commit did
+ * before the user tables had prepared statements; without it, prepared
+ * statements are bound. Returns the time of a sentence in microseconds. */
+double writeSentence (const PhraseArray & sentence, size_t rounds, bool text)
+{
+    sqlite3 *db = NULL;
+    sqlite3_open (":memory:", &db);
+
+    String sql;
+    for (size_t i = 0; i < MAX_PHRASE_LEN; i++) {
+        sql.appendPrintf ("CREATE TABLE py_phrase_%d (user_freq, phrase TEXT, freq INTEGER", (int) i);
+        for (size_t j = 0; j <= i; j++)
+            sql.appendPrintf (",s%d INTEGER,y%d INTEGER", (int) j, (int) j);
+        sql.appendPrintf (");\nCREATE UNIQUE INDEX index_%d_0 ON py_phrase_%d(s0,y0", (int) i, (int) i);
+        for (size_t j = 1; j <= i; j++)
+            sql.appendPrintf (",s%d,y%d", (int) j, (int) j);
+        sql << ",phrase);\n";
+    }
+    sqlite3_exec (db, sql, NULL, NULL, NULL);
+
+    sqlite3_stmt *inserts[MAX_PHRASE_LEN] = { NULL };
+    sqlite3_stmt *updates[MAX_PHRASE_LEN] = { NULL };
+    for (size_t i = 0; !text && i < MAX_PHRASE_LEN; i++) {
+        sql.printf ("INSERT OR IGNORE INTO py_phrase_%d VALUES(0,?1,?2", (int) i);
+        for (size_t j = 0; j <= i; j++)
+            sql.appendPrintf (",?%d,?%d", (int) (3 + j * 2), (int) (4 + j * 2));
+        sql << ")";
+        sqlite3_prepare_v2 (db, sql, -1, &inserts[i], NULL);
+        sql.printf ("UPDATE py_phrase_%d SET user_freq=user_freq+1 WHERE phrase=?1", (int) i);
+        for (size_t j = 0; j <= i; j++)
+            sql.appendPrintf (" AND s%d=?%d AND y%d=?%d", (int) j, (int) (3 + j * 2), (int) j, (int) (4 + j * 2));
+        sqlite3_prepare_v2 (db, sql, -1, &updates[i], NULL);
+    }
+
+    GTimer *timer = g_timer_new ();
+    for (size_t r = 0; r < rounds; r++) {
+        sqlite3_exec (db, "BEGIN TRANSACTION;", NULL, NULL, NULL);
+        for (size_t i = 0; i < sentence.size (); i++) {
+            const Phrase & p = sentence[i];
+            if (text) {
+                sql.clear ();
+                sql << "INSERT OR IGNORE INTO py_phrase_" << p.len - 1
+                    << " VALUES(" << 0 << ",\"" << p.phrase << '"' << ',' << p.freq;
+                for (size_t j = 0; j < p.len; j++)
+                    sql << ',' << p.pinyin_id[j].sheng << ',' << p.pinyin_id[j].yun;
+                sql << ");\n";
+                sql << "UPDATE py_phrase_" << p.len - 1 << " SET user_freq=user_freq+" << 1
+                    << " WHERE s0=" << p.pinyin_id[0].sheng << " AND y0=" << p.pinyin_id[0].yun;
+                for (size_t j = 1; j < p.len; j++)
+                    sql << " AND s" << j << '=' << p.pinyin_id[j].sheng
+                        << " AND y" << j << '=' << p.pinyin_id[j].yun;
+                sql << " AND phrase=\"" << p.phrase << "\";\n";
+                sqlite3_exec (db, sql, NULL, NULL, NULL);
+                continue;
+            }
+            sqlite3_stmt *stmts[] = { inserts[p.len - 1], updates[p.len - 1] };
+            for (size_t k = 0; k < G_N_ELEMENTS (stmts); k++) {
+                sqlite3_bind_text (stmts[k], 1, p.phrase, -1, SQLITE_STATIC);
+                if (k == 0)
+                    sqlite3_bind_int (stmts[k], 2, p.freq);
+                for (size_t j = 0; j < p.len; j++) {
+                    sqlite3_bind_int (stmts[k], 3 + j * 2, p.pinyin_id[j].sheng);
+                    sqlite3_bind_int (stmts[k], 4 + j * 2, p.pinyin_id[j].yun);
+                }
+                sqlite3_step (stmts[k]);
+                sqlite3_reset (stmts[k]);
+            }
+        }
+        sqlite3_exec (db, "COMMIT;", NULL, NULL, NULL);
+    }
+    double elapsed = g_timer_elapsed (timer, NULL);
+    g_timer_destroy (timer);
+
+    for (size_t i = 0; i < MAX_PHRASE_LEN; i++) {
+        sqlite3_finalize (inserts[i]);
+        sqlite3_finalize (updates[i]);
+    }
+    sqlite3_close (db);
+
+    return elapsed * 1000000 / rounds;
+}
+
+void benchCommit ()
+{
+    static const char *words[] = { "women", "mingtian", "qu", "beijing", "kaihui" };
+    const unsigned int option = PINYIN_INCOMPLETE_PINYIN | PINYIN_CORRECT_ALL;
+    const size_t rounds = BENCH_ROUNDS * 100;
+
+    PhraseArray sentence;
+    for (size_t i = 0; i < G_N_ELEMENTS (words); i++) {
+        PinyinArray pinyin;
+        String text (words[i]);
+        PinyinParser::parse (text, text.size (), option, pinyin, MAX_PHRASE_LEN);
+
+        PhraseArray phrases;
+        Query query (pinyin, 0, pinyin.size (), option);
+        query.fill (phrases, 1);
+        sentence.push_back (phrases[0]);
+    }
+
+    printf ("commit latency (us per sentence of %zu phrases)\n", sentence.size ());
+    printf ("%-8s %12s %12s\n", "", "flushed", "buffered");
+
+    GTimer *timer = g_timer_new ();
+    for (size_t r = 0; r < rounds; r++) {
+        PhraseSource::instance ().commit (sentence);
+        PhraseSource::instance ().flush ();
+    }
+    double flushed = g_timer_elapsed (timer, NULL);
+
+    g_timer_start (timer);
+    for (size_t r = 0; r < rounds; r++)
+        PhraseSource::instance ().commit (sentence);
+    PhraseSource::instance ().flush ();
+    double buffered = g_timer_elapsed (timer, NULL);
+    g_timer_destroy (timer);
+
+    printf ("%-8s %12.1f %12.1f\n", "commit",
+            flushed * 1000000 / rounds, buffered * 1000000 / rounds);
+
+    /* the writes alone, without the rest of commit */
+    printf ("%-8s %12s %12s\n", "", "sql text", "bound");
+    printf ("%-8s %12.1f %12.1f\n", "write",
+            writeSentence (sentence, rounds, true), writeSentence (sentence, rounds, false));
+}
+
+/* Times importing every main phrase as a user phrase, and exporting the
+ * user dictionary after it. */
+void benchImportExport (const string & dir)
+{
+    PhraseArray phrases;
+    Database::instance ().mainPhrases (phrases);
+
+    const string input = dir + G_DIR_SEPARATOR_S "import.txt";
+    const string output = dir + G_DIR_SEPARATOR_S "export.txt";
+    FILE *file = g_fopen (input.c_str (), "w");
+    fprintf (file, "# pyzy user phrases 1.0\n");
+    for (size_t i = 0; i < phrases.size (); i++) {
+        fprintf (file, "%s\t1\t%u\t0", phrases[i].phrase, phrases[i].freq);
+        for (size_t j = 0; j < phrases[i].len; j++)
+            fprintf (file, "\t%d\t%d", phrases[i].pinyin_id[j].sheng, phrases[i].pinyin_id[j].yun);
+        fprintf (file, "\n");
+    }
+    fclose (file);
+
+    GTimer *timer = g_timer_new ();
+    InputContext::importUserPhrases (input);
+    double imported = g_timer_elapsed (timer, NULL);
+
+    g_timer_start (timer);
+    InputContext::exportUserPhrases (output);
+    double exported = g_timer_elapsed (timer, NULL);
+    g_timer_destroy (timer);
+
+    printf ("user phrase interchange (s for %zu phrases)\n", phrases.size ());
+    printf ("%-8s %12s %12s\n", "", "import", "export");
+    printf ("%-8s %12.2f %12.2f\n", "phrases", imported, exported);
+}
+
+string getTestDir ()
+{
+    const char *kPyZyTestDirName = "__pyzy_benchmark_dir__";
+
+    gchar *path = g_build_filename (g_get_tmp_dir(), kPyZyTestDirName, NULL);
+    const string result = path;
+    g_free (path);
+    return result;
+}
+
+bool removeDirectory (const string &path) {
+    GDir *dir = g_dir_open (path.c_str (), 0, NULL);
+    if (dir == NULL) {
+        return false;
+    }
+
+    const gchar *entry_name = NULL;
+    while ((entry_name = g_dir_read_name (dir)) != NULL) {
+        gchar *entry_path = g_build_filename (path.c_str (), entry_name, NULL);
+
+        if (g_file_test (entry_path, G_FILE_TEST_IS_DIR)) {
+            removeDirectory (entry_path);
+        } else {
+            g_unlink (entry_path);
+        }
+
+        g_free (entry_path);
+    }
+
+    g_dir_close (dir);
+    int ret = g_rmdir (path.c_str ());
+
+    return ret == 0;
+}
+
+/* Times InputContext::init, and the first keystroke after it, which waits
+ * until the dictionaries are loaded. */
+void benchStartup (unsigned int flags)
+{
+    const string test_dir = getTestDir ();
+    DummyObserver observer;
+    GTimer *timer = g_timer_new ();
+
+    InputContext::init (test_dir, test_dir, flags);
+    double init = g_timer_elapsed (timer, NULL);
+
+    unique_ptr<InputContext> context;
+    context.reset (InputContext::create (InputContext::FULL_PINYIN, &observer));
+    context->insert ('n');
+    context->hasCandidate (0);
+    double first = g_timer_elapsed (timer, NULL);
+    g_timer_destroy (timer);
+
+    printf ("startup latency (ms)\n");
+    printf ("%-8s %12s %12s\n", "", "init", "first key");
+    printf ("%-8s %12.1f %12.1f\n", "startup", init * 1000, first * 1000);
+}
+
+/* Prints the resident memory of this process. The pages of a mapped file
+ * are in RssFile, and can be shared with other processes. */
+void benchMemory ()
+{
+    static const char *fields[] = { "VmRSS:", "RssAnon:", "RssFile:" };
+    gchar *status = NULL;
+
+    if (!g_file_get_contents ("/proc/self/status", &status, NULL, NULL))
+        return;
+
+    printf ("resident memory (kB)\n");
+    gchar **lines = g_strsplit (status, "\n", -1);
+    for (gchar **line = lines; *line != NULL; line++) {
+        for (size_t i = 0; i < G_N_ELEMENTS (fields); i++) {
+            if (g_str_has_prefix (*line, fields[i]))
+                printf ("%-8s %12ld\n", fields[i], atol (*line + strlen (fields[i])));
+        }
+    }
+    g_strfreev (lines);
+    g_free (status);
+}
+
+void tearDown ()
+{
+    InputContext::finalize ();
+    removeDirectory (getTestDir ());
+}
+
+int main (int argc, char **argv)
+{
+    /* --shared opens the main database with INIT_MAIN_DB_SHARED, and
+     * --sqlite, --mapped or --memory chooses the backend */
+    unsigned int flags = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp (argv[i], "--shared") == 0)
+            flags |= INIT_MAIN_DB_SHARED;
+        else if (strcmp (argv[i], "--sqlite") == 0)
+            flags = (flags & ~INIT_BACKEND_MASK) | INIT_BACKEND_SQLITE;
+        else if (strcmp (argv[i], "--mapped") == 0)
+            flags = (flags & ~INIT_BACKEND_MASK) | INIT_BACKEND_MAPPED;
+        else if (strcmp (argv[i], "--memory") == 0)
+            flags = (flags & ~INIT_BACKEND_MASK) | INIT_BACKEND_MEMORY;
+    }
+
+    benchStartup (flags);
+    benchFuzzy ();
+    benchBeam ();
+    benchQueryStats ();
+    benchFirstPage ();
+    benchAbbreviation ();
+    benchCommit ();
+    benchMemory ();
+    benchImportExport (getTestDir ());
+    tearDown ();
+
+    return 0;
+}